@@ -0,0 +1,387 @@
+#include <functional>
+#include <fstream>
+
+#include "args.hpp"
+#include "multitracker.hpp"
+#include "pipeline.hpp"
+#include "processor_base.hpp"
+
+namespace detector {
+
+    struct KernelResult {
+        string kernel;
+        int objects;
+        cv::Size2i frameSize;
+        vector<double> samples;
+        // Only reported by tracking scenarios.
+        int idSwitches = -1;
+    };
+
+    // Random boxes spread over the whole frame, sized like objects seen from a street camera.
+    vector<cv::Rect2i> makeBoxes(cv::RNG &rng, const cv::Size2i &frameSize, const int &count) {
+        vector<cv::Rect2i> boxes;
+        for (int i = 0; i < count; i++) {
+            int width = rng.uniform(std::max(frameSize.width / 40, 2), std::max(frameSize.width / 10, 3));
+            int height = rng.uniform(std::max(frameSize.height / 20, 2), std::max(frameSize.height / 5, 3));
+            boxes.emplace_back(rng.uniform(0, frameSize.width - width), rng.uniform(0, frameSize.height - height),
+                               width, height);
+        }
+        return boxes;
+    }
+
+    // Moves every box by a few pixels, as if it was seen one frame later.
+    vector<cv::Rect2i> jitterBoxes(cv::RNG &rng, const vector<cv::Rect2i> &boxes) {
+        vector<cv::Rect2i> jittered;
+        for (auto &box: boxes) {
+            // Detector boxes are never empty, whatever the size of the box they are jittered from.
+            jittered.emplace_back(box.x + rng.uniform(-3, 4), box.y + rng.uniform(-3, 4),
+                                  std::max(1, box.width + rng.uniform(-2, 3)),
+                                  std::max(1, box.height + rng.uniform(-2, 3)));
+        }
+        return jittered;
+    }
+
+    // Runs f once untimed to warm caches up, then iterations times, returning durations in microseconds.
+    vector<double> measure(const int &iterations, const std::function<void()> &f) {
+        f();
+        vector<double> samples;
+        for (int i = 0; i < iterations; i++) {
+            auto startTime = std::chrono::steady_clock::now();
+            f();
+            samples.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - startTime).count());
+        }
+        return samples;
+    }
+
+    KernelResult benchAssociation(const AssociationMethod &method, const cv::Size2i &frameSize, const int &nObjects,
+                                  const int &iterations, const uint64_t &seed) {
+        cv::RNG rng(seed);
+        auto tracks = makeBoxes(rng, frameSize, nObjects);
+        auto detections = jitterBoxes(rng, tracks);
+        Associator associator;
+        associator.configure(method, 0.3);
+        vector<int> detectionToTrack;
+        auto samples = measure(iterations, [&] {
+            associator.associate(detections, tracks, detectionToTrack);
+        });
+        string name = method == AssociationMethod::HUNGARIAN ? "associate_hungarian" : "associate_greedy";
+        return KernelResult{name, nObjects, frameSize, std::move(samples)};
+    }
+
+    // Full MultiTracker::addTrackers call once every detection already has a tracker, i.e. the matching
+    // path that runs on every detection of a steady scene.
+    KernelResult benchAddTrackers(const cv::Size2i &frameSize, const int &nObjects, const int &iterations,
+                                  const uint64_t &seed) {
+        cv::RNG rng(seed);
+        cv::Mat frame(frameSize, CV_8UC3, cv::Scalar(96, 96, 96));
+        auto boxes = makeBoxes(rng, frameSize, nObjects);
+        for (auto &box: boxes) {
+            cv::rectangle(frame, box, cv::Scalar(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256)),
+                          cv::FILLED);
+        }
+        auto toDetections = [](const vector<cv::Rect2i> &bboxes) {
+            vector<DetectionResult> detectedObjects;
+            for (auto &bbox: bboxes) {
+                detectedObjects.emplace_back(static_cast<int>(ObjectClass::CAR), 90, bbox);
+            }
+            return detectedObjects;
+        };
+        MultiTracker multiTracker(ProcessorBase::minTrackingQuality);
+        multiTracker.update(frame);
+        multiTracker.addTrackers(frame, toDetections(boxes));
+
+        vector<cv::Rect2i> trackedBoxes;
+        multiTracker.forEachObject([&](const TrackedObjectView &obj) {
+            trackedBoxes.push_back(obj.bbox);
+        });
+        auto detectedObjects = toDetections(jitterBoxes(rng, trackedBoxes));
+        auto samples = measure(iterations, [&] {
+            multiTracker.addTrackers(frame, detectedObjects);
+        });
+        return KernelResult{"add_trackers", nObjects, frameSize, std::move(samples)};
+    }
+
+    // A scene of nObjects boxes moving over frames, detected every detectInterval frames. Times the
+    // per-frame MultiTracker update (and addTrackers on detection frames) and counts identity switches:
+    // a box followed by another tracked object than on the previous frame it was followed at all.
+    KernelResult benchTracking(const string &trackerName, const cv::Size2i &frameSize, const int &nObjects,
+                               const int &nFrames, const int &detectInterval, const size_t &trackerSkip,
+                               const uint64_t &seed) {
+        TrackerBackend backend;
+        parseTrackerBackend(trackerName, backend);
+        cv::RNG rng(seed);
+        auto boxes = makeBoxes(rng, frameSize, nObjects);
+        vector<cv::Point2i> velocities;
+        vector<cv::Scalar> colors;
+        for (int i = 0; i < nObjects; i++) {
+            velocities.emplace_back(rng.uniform(-6, 7), rng.uniform(-3, 4));
+            colors.emplace_back(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+        }
+
+        MultiTracker multiTracker(ProcessorBase::minTrackingQuality);
+        multiTracker.setTrackerBackend(backend);
+        multiTracker.setMotionModel(SpeedEstimator::KALMAN, trackerSkip);
+        Associator associator;
+        associator.configure(AssociationMethod::GREEDY, 0.3);
+        cv::Mat frame(frameSize, CV_8UC3);
+        vector<DetectionResult> detectedObjects;
+        vector<cv::Rect2i> trackedBoxes;
+        vector<int> trackedIds;
+        vector<int> boxToTrack;
+        vector<int> lastIds(nObjects, -1);
+        int idSwitches = 0;
+        vector<double> samples;
+        for (int frameIndex = 0; frameIndex < nFrames; frameIndex++) {
+            frame.setTo(cv::Scalar(96, 96, 96));
+            for (int i = 0; i < nObjects; i++) {
+                cv::rectangle(frame, boxes[i], colors[i], cv::FILLED);
+            }
+            bool detect = frameIndex % detectInterval == 0;
+            if (detect) {
+                detectedObjects.clear();
+                for (auto &bbox: jitterBoxes(rng, boxes)) {
+                    detectedObjects.emplace_back(static_cast<int>(ObjectClass::CAR), 90, bbox);
+                }
+            }
+
+            auto startTime = std::chrono::steady_clock::now();
+            multiTracker.update(frame);
+            if (detect) {
+                multiTracker.addTrackers(frame, detectedObjects);
+            }
+            // The first frame only starts trackers.
+            if (frameIndex > 0) {
+                samples.push_back(
+                        std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - startTime).count());
+            }
+
+            trackedBoxes.clear();
+            trackedIds.clear();
+            multiTracker.forEachObject([&](const TrackedObjectView &obj) {
+                trackedBoxes.push_back(obj.bbox);
+                trackedIds.push_back(obj.objID);
+            });
+            associator.associate(boxes, trackedBoxes, boxToTrack);
+            for (int i = 0; i < nObjects; i++) {
+                if (boxToTrack[i] == -1) {
+                    continue;
+                }
+                auto objID = trackedIds[boxToTrack[i]];
+                if (lastIds[i] != -1 && lastIds[i] != objID) {
+                    idSwitches++;
+                }
+                lastIds[i] = objID;
+            }
+
+            for (int i = 0; i < nObjects; i++) {
+                auto &box = boxes[i];
+                box.x += velocities[i].x;
+                box.y += velocities[i].y;
+                if (box.x < 0 || box.x + box.width > frameSize.width) {
+                    velocities[i].x = -velocities[i].x;
+                    box.x = std::clamp(box.x, 0, frameSize.width - box.width);
+                }
+                if (box.y < 0 || box.y + box.height > frameSize.height) {
+                    velocities[i].y = -velocities[i].y;
+                    box.y = std::clamp(box.y, 0, frameSize.height - box.height);
+                }
+            }
+        }
+        return KernelResult{"track_" + trackerName, nObjects, frameSize, std::move(samples), idSwitches};
+    }
+
+    KernelResult benchSpeeds(const SpeedEstimator &estimator, const cv::Size2i &frameSize, const int &nObjects,
+                             const int &historyLength, const int &iterations, const uint64_t &seed) {
+        cv::RNG rng(seed);
+        ObjectStore objects;
+        objects.setHistoryLength(historyLength);
+        auto boxes = makeBoxes(rng, frameSize, nObjects);
+        for (int i = 0; i < nObjects; i++) {
+            objects.add(i, boxes[i], static_cast<int>(ObjectClass::CAR), 0.9f, "Car: 90%", 0);
+        }
+        for (int frameIndex = 1; frameIndex < historyLength; frameIndex++) {
+            boxes = jitterBoxes(rng, boxes);
+            for (int i = 0; i < nObjects; i++) {
+                objects.motion(i).predict();
+                objects.motion(i).correct(boxes[i], MotionFilter::trackerNoise);
+                objects.update(i, boxes[i]);
+            }
+        }
+        SpeedDetector speedDetector;
+        speedDetector.setEstimator(estimator);
+        auto samples = measure(iterations, [&] {
+            speedDetector.updateSpeeds(objects, 25.);
+        });
+        string name = estimator == SpeedEstimator::KALMAN ? "update_speeds_kalman" : "update_speeds";
+        return KernelResult{name, nObjects, frameSize, std::move(samples)};
+    }
+
+    // Decoding of a synthetic network output with nObjects rows, of which every other one passes the class
+    // filter, non-maximum suppression included. A sparse output is what SSD mostly returns: rows padded up to
+    // its keep_top_k, nearly all of them below the confidence threshold, so that the filter pass dominates.
+    KernelResult benchDecode(const cv::Size2i &frameSize, const int &nObjects, const bool &sparse,
+                             const int &iterations, const uint64_t &seed) {
+        cv::RNG rng(seed);
+        int sizes[] = {1, 1, nObjects, 7};
+        cv::Mat out(4, sizes, CV_32F);
+        for (int i = 0; i < nObjects; i++) {
+            auto &row = out.at<cv::Vec<float, 7>>(0, 0, i);
+            float x = rng.uniform(0.f, 0.9f);
+            float y = rng.uniform(0.f, 0.8f);
+            auto classId = static_cast<float>(i % 2 ? ObjectClass::CAR : ObjectClass::DOG);
+            auto confidence = sparse && i % 20 ? rng.uniform(0.f, 0.4f) : rng.uniform(0.2f, 1.f);
+            row = cv::Vec<float, 7>(0.f, classId, confidence, x, y, x + 0.1f, y + 0.2f);
+        }
+        vector<InputTransform> transforms{InputTransform{frameSize.width, frameSize.height}};
+        auto classMask = makeClassMask({static_cast<int>(ObjectClass::PERSON), static_cast<int>(ObjectClass::CAR)});
+        MobileNetSSD net;
+        vector<vector<DetectionResult>> detectedObjects;
+        auto samples = measure(iterations, [&] {
+            net.decodeDetections(out, transforms, classMask, 0.4f, detectedObjects);
+        });
+        return KernelResult{sparse ? "decode_detections_sparse" : "decode_detections", nObjects, frameSize,
+                            std::move(samples)};
+    }
+
+    struct KernelBenchArgs {
+        vector<int> _objects;
+        int _width = 1280;
+        int _height = 720;
+        int _iterations = 200;
+        int _historyLength = 8;
+        int _seed = 42;
+        bool _skipAddTrackers = false;
+        vector<string> _trackers;
+        int _trackFrames = 100;
+        int _detectInterval = 5;
+        int _trackerSkip = 1;
+        string _jsonFileName;
+
+        KernelBenchArgs() = default;
+
+        static const char *help() {
+            return "Micro-benchmarks of the per-frame kernels (association, tracker matching, speed estimation, "
+                   "detection decoding) on synthetic boxes, and a comparison of object trackers on a moving "
+                   "scene, reported as JSON";
+        }
+
+        template<class F>
+        void parse(F f) {
+            f(_objects, "--objects",
+              args::help("Object counts to benchmark. Default value: 1 10 100 1000"));
+            f(_width, "--width",
+              args::help("Frame width. Default value: 1280"));
+            f(_height, "--height",
+              args::help("Frame height. Default value: 720"));
+            f(_iterations, "--iterations",
+              args::help("Timed runs of every kernel. Default value: 200"));
+            f(_historyLength, "--history-length",
+              args::help("Number of positions kept per object for speed estimation. Default value: 8"));
+            f(_seed, "--seed",
+              args::help("Seed of the synthetic boxes. Default value: 42"));
+            f(_skipAddTrackers, "--skip-add-trackers",
+              args::help("Skip the MultiTracker::addTrackers benchmark, which starts a correlation tracker "
+                         "per object first"), args::set(true));
+            f(_trackers, "--trackers",
+              args::help("Object trackers compared on a moving scene: 'dlib', 'mosse', 'iou'. Default value: "
+                         "dlib mosse iou"));
+            f(_trackFrames, "--track-frames",
+              args::help("Frames of the moving scene, 0 to skip the tracker comparison. Default value: 100"));
+            f(_detectInterval, "--detect-interval",
+              args::help("Frames between two detections in the moving scene. Default value: 5"));
+            f(_trackerSkip, "--tracker-skip",
+              args::help("Frames between two updates of trackers of stable objects in the moving scene. "
+                         "Default value: 1"));
+            f(_jsonFileName, "--json",
+              args::help("File the JSON report is written to. By default it is printed to stdout"));
+        }
+
+        void run() {
+            if (_width < 64 || _height < 64) {
+                std::cerr << "Incorrect frame size. Width and height must be at least 64" << std::endl;
+                return;
+            }
+            if (_iterations < 1 || _historyLength < 2) {
+                std::cerr << "Incorrect number of iterations or history length" << std::endl;
+                return;
+            }
+            if (_trackFrames < 0 || _detectInterval < 1 || _trackerSkip < 1) {
+                std::cerr << "Incorrect number of scene frames, detection interval or tracker skip" << std::endl;
+                return;
+            }
+            if (_trackers.empty()) {
+                _trackers = vector<string>{"dlib", "mosse", "iou"};
+            }
+            for (auto &tracker: _trackers) {
+                TrackerBackend backend;
+                if (!parseTrackerBackend(tracker, backend)) {
+                    std::cerr << "Incorrect object tracker: " << tracker << std::endl;
+                    return;
+                }
+            }
+            if (_objects.empty()) {
+                _objects = vector<int>{1, 10, 100, 1000};
+            }
+            cv::Size2i frameSize(_width, _height);
+            vector<KernelResult> results;
+            for (auto nObjects: _objects) {
+                if (nObjects < 1) {
+                    std::cerr << "Incorrect object count: " << nObjects << std::endl;
+                    return;
+                }
+                std::clog << "Benchmarking " << nObjects << " objects" << std::endl;
+                results.push_back(benchAssociation(AssociationMethod::GREEDY, frameSize, nObjects, _iterations, _seed));
+                results.push_back(benchAssociation(AssociationMethod::HUNGARIAN, frameSize, nObjects, _iterations, _seed));
+                if (!_skipAddTrackers) {
+                    results.push_back(benchAddTrackers(frameSize, nObjects, _iterations, _seed));
+                }
+                results.push_back(benchSpeeds(SpeedEstimator::HISTORY, frameSize, nObjects, _historyLength,
+                                              _iterations, _seed));
+                results.push_back(benchSpeeds(SpeedEstimator::KALMAN, frameSize, nObjects, _historyLength,
+                                              _iterations, _seed));
+                results.push_back(benchDecode(frameSize, nObjects, false, _iterations, _seed));
+                results.push_back(benchDecode(frameSize, nObjects, true, _iterations, _seed));
+                if (_trackFrames > 1) {
+                    for (auto &tracker: _trackers) {
+                        results.push_back(benchTracking(tracker, frameSize, nObjects, _trackFrames, _detectInterval,
+                                                        _trackerSkip, _seed));
+                    }
+                }
+            }
+
+            std::ofstream jsonFile;
+            if (!_jsonFileName.empty()) {
+                jsonFile.open(_jsonFileName);
+                if (!jsonFile.is_open()) {
+                    std::cerr << "Cannot open JSON report file: " << _jsonFileName << std::endl;
+                    exit(-1);
+                }
+            }
+            std::ostream &out = _jsonFileName.empty() ? std::cout : jsonFile;
+            out << "[\n";
+            for (size_t i = 0; i < results.size(); i++) {
+                auto &result = results[i];
+                auto mean = std::accumulate(result.samples.begin(), result.samples.end(), 0.) /
+                            double(result.samples.size());
+                out << "  {\"kernel\": \"" << result.kernel << "\", \"objects\": " << result.objects
+                    << ", \"width\": " << result.frameSize.width << ", \"height\": " << result.frameSize.height
+                    << ", \"iterations\": " << result.samples.size() << ", \"mean_us\": " << mean
+                    << ", \"p50_us\": " << percentile(result.samples, 50)
+                    << ", \"p95_us\": " << percentile(result.samples, 95)
+                    << ", \"p99_us\": " << percentile(result.samples, 99);
+                if (result.idSwitches >= 0) {
+                    out << ", \"id_switches\": " << result.idSwitches;
+                }
+                out << "}"
+                    << (i + 1 < results.size() ? ",\n" : "\n");
+            }
+            out << "]" << std::endl;
+            exit(0);
+        }
+    };
+
+} // namespace detector
+
+int main(int argc, char const *argv[]) {
+    args::parse<detector::KernelBenchArgs>(argc, argv);
+}
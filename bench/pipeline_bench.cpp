@@ -0,0 +1,419 @@
+#include <sys/resource.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+#include "args.hpp"
+#include "processor.hpp"
+
+namespace detector {
+
+    namespace fs = std::filesystem;
+
+    struct SyntheticObject {
+        cv::Rect2i bbox;
+        cv::Point2i velocity;
+        cv::Scalar color;
+    };
+
+    // Renders a clip of solid boxes moving over a flat background and bouncing off the frame borders, and
+    // returns the boxes of every frame as detections. The model does not see cars in solid boxes, so these
+    // are fed to the processor instead. The scene only depends on the seed, so two runs with the same
+    // parameters replay the same frames and detections.
+    vector<vector<DetectionResult>> writeSyntheticClip(const string &fileName, const cv::Size2i &frameSize,
+                                                       const int &nFrames, const int &nObjects, const uint64_t &seed) {
+        cv::RNG rng(seed);
+        vector<SyntheticObject> objects(nObjects);
+        for (auto &obj: objects) {
+            int width = rng.uniform(frameSize.width / 20, frameSize.width / 6);
+            int height = rng.uniform(frameSize.height / 12, frameSize.height / 4);
+            obj.bbox = cv::Rect2i(rng.uniform(0, frameSize.width - width), rng.uniform(0, frameSize.height - height),
+                                  width, height);
+            obj.velocity = cv::Point2i(rng.uniform(-8, 9), rng.uniform(-4, 5));
+            obj.color = cv::Scalar(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256));
+        }
+
+        cv::VideoWriter writer(fileName, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), 25, frameSize, true);
+        if (!writer.isOpened()) {
+            std::cerr << "Cannot open synthetic clip for writing: " << fileName << std::endl;
+            exit(-1);
+        }
+        vector<vector<DetectionResult>> groundTruth(nFrames);
+        cv::Mat frame(frameSize, CV_8UC3);
+        for (int i = 0; i < nFrames; i++) {
+            frame.setTo(cv::Scalar(96, 96, 96));
+            for (auto &obj: objects) {
+                cv::rectangle(frame, obj.bbox, obj.color, cv::FILLED);
+                groundTruth[i].emplace_back(static_cast<int>(ObjectClass::CAR), 100, obj.bbox);
+                obj.bbox.x += obj.velocity.x;
+                obj.bbox.y += obj.velocity.y;
+                if (obj.bbox.x < 0 || obj.bbox.x + obj.bbox.width > frameSize.width) {
+                    obj.velocity.x = -obj.velocity.x;
+                    obj.bbox.x = std::clamp(obj.bbox.x, 0, frameSize.width - obj.bbox.width);
+                }
+                if (obj.bbox.y < 0 || obj.bbox.y + obj.bbox.height > frameSize.height) {
+                    obj.velocity.y = -obj.velocity.y;
+                    obj.bbox.y = std::clamp(obj.bbox.y, 0, frameSize.height - obj.bbox.height);
+                }
+            }
+            writer.write(frame);
+        }
+        writer.release();
+        return groundTruth;
+    }
+
+    void writeJsonString(std::ostream &out, const string &value) {
+        out << '"';
+        for (auto c: value) {
+            if (c == '"' || c == '\\') {
+                out << '\\' << c;
+            } else if (static_cast<unsigned char>(c) < 0x20) {
+                char buffer[8];
+                std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+                out << buffer;
+            } else {
+                out << c;
+            }
+        }
+        out << '"';
+    }
+
+    // Peak resident set size of the process in kilobytes.
+    long getPeakRss() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+
+    void writeLatencies(std::ostream &out, const vector<double> &samples) {
+        auto mean = samples.empty() ? 0. : std::accumulate(samples.begin(), samples.end(), 0.) / double(samples.size());
+        out << "{\"count\": " << samples.size() << ", \"mean_ms\": " << mean
+            << ", \"p50_ms\": " << percentile(samples, 50) << ", \"p95_ms\": " << percentile(samples, 95)
+            << ", \"p99_ms\": " << percentile(samples, 99) << "}";
+    }
+
+    struct InferenceComparison {
+        vector<double> referenceLatencies;
+        vector<double> candidateLatencies;
+        uint64_t referenceObjects = 0;
+        uint64_t candidateObjects = 0;
+        uint64_t matchedObjects = 0;
+    };
+
+    // Runs the first frames of the clip through an FP32 reference model and through the candidate
+    // configuration. Agreement is measured against the reference: detections of the same class with an
+    // IoU of at least 0.5 are matched greedily, recall is the share of reference detections matched and
+    // precision the share of candidate ones.
+    // The thread count of OpenCV is process-wide, so it is set before every forward pass: the reference
+    // runs with OpenCV's default, the candidate with the configured threads.
+    InferenceComparison compareInference(const string &clip, const int &nFrames, const string &referenceModelPath,
+                                         const string &modelPath, const InferenceOptions &options,
+                                         const ClassMask &classMask, const float &confCoefficient) {
+        MobileNetSSD reference;
+        MobileNetSSD candidate;
+        auto referenceThreads = cv::getNumThreads();
+        auto candidateThreads = options.threads > 0 ? options.threads : referenceThreads;
+        try {
+            reference.loadModel(referenceModelPath);
+            candidate.setInferenceOptions(options);
+            candidate.loadModel(modelPath);
+            cv::setNumThreads(referenceThreads);
+            reference.warmUp();
+            cv::setNumThreads(candidateThreads);
+            candidate.warmUp();
+        } catch (std::exception &e) {
+            std::cerr << "Error on loading MobileNetSSD model: " << e.what() << std::endl;
+            exit(-1);
+        }
+        cv::VideoCapture cap(clip);
+        cv::Mat frame;
+        vector<DetectionResult> referenceObjects;
+        vector<DetectionResult> candidateObjects;
+        vector<bool> matched;
+        InferenceComparison comparison;
+        for (int i = 0; i < nFrames && cap.read(frame); i++) {
+            cv::setNumThreads(referenceThreads);
+            auto startTime = steady_clock::now();
+            reference.detectObjects(frame, classMask, confCoefficient, referenceObjects);
+            auto referenceTime = steady_clock::now();
+            cv::setNumThreads(candidateThreads);
+            candidate.detectObjects(frame, classMask, confCoefficient, candidateObjects);
+            auto candidateTime = steady_clock::now();
+            comparison.referenceLatencies.push_back(duration<double, std::milli>(referenceTime - startTime).count());
+            comparison.candidateLatencies.push_back(duration<double, std::milli>(candidateTime - referenceTime).count());
+
+            comparison.referenceObjects += referenceObjects.size();
+            comparison.candidateObjects += candidateObjects.size();
+            matched.assign(candidateObjects.size(), false);
+            for (auto &referenceObj: referenceObjects) {
+                int best = -1;
+                double bestIou = 0.5;
+                for (size_t c = 0; c < candidateObjects.size(); c++) {
+                    auto overlap = iou(referenceObj.bbox, candidateObjects[c].bbox);
+                    if (!matched[c] && candidateObjects[c].classId == referenceObj.classId && overlap >= bestIou) {
+                        best = static_cast<int>(c);
+                        bestIou = overlap;
+                    }
+                }
+                if (best >= 0) {
+                    matched[best] = true;
+                    comparison.matchedObjects++;
+                }
+            }
+        }
+        return comparison;
+    }
+
+    struct BenchArgs {
+        string _clip;
+        int _frames = 300;
+        int _width = 1280;
+        int _height = 720;
+        int _objects = 16;
+        int _seed = 42;
+        string _modelPath = "model/MobileNetSSD";
+        string _inferenceBackend = "opencv";
+        string _precision = "fp32";
+        int _dnnThreads = 0;
+        int _compareFrames = 0;
+        string _referenceModelPath = "model/MobileNetSSD";
+        set<int> _classesSet{};
+        float _confCoefficient = 0.4;
+        int _detectInterval = 1;
+        int _tileBudget = 1;
+        int _trackerThreads = 0;
+        string _tracker = "dlib";
+        float _trackingScale = 1.;
+        int _trackerSkip = 1;
+        bool _motionGate = false;
+        bool _usePipeline = false;
+        bool _noEncode = false;
+        string _jsonFileName;
+
+        BenchArgs() = default;
+
+        static const char *help() {
+            return "Benchmark of the full frame pipeline: replays a clip through the video processor headless "
+                   "and reports throughput, latency percentiles of every stage and peak memory as JSON";
+        }
+
+        template<class F>
+        void parse(F f) {
+            f(_clip, "--clip",
+              args::help("Recorded clip to replay, detected by the model. By default a synthetic clip is generated "
+                         "and its boxes are fed as detections every detection interval"));
+            f(_frames, "--frames",
+              args::help("Number of frames of the synthetic clip. Default value: 300"));
+            f(_width, "--width",
+              args::help("Frame width of the synthetic clip. Default value: 1280"));
+            f(_height, "--height",
+              args::help("Frame height of the synthetic clip. Default value: 720"));
+            f(_objects, "--objects",
+              args::help("Number of moving objects in the synthetic clip. Default value: 16"));
+            f(_seed, "--seed",
+              args::help("Seed of the synthetic clip. Default value: 42"));
+            f(_modelPath, "--model-path", "-m",
+              args::help("MobileNetSSD folder path"));
+            f(_inferenceBackend, "--inference-backend",
+              args::help("Backend running the model: 'opencv', 'openvino' or 'cuda'. Default value: opencv"));
+            f(_precision, "--precision",
+              args::help("Inference precision: 'fp32', 'fp16' or 'int8'. Default value: fp32"));
+            f(_dnnThreads, "--dnn-threads",
+              args::help("Number of threads of OpenCV's parallel loops. Default value: 0 (OpenCV's default)"));
+            f(_compareFrames, "--compare-inference",
+              args::help("Before the pipeline run, detect this many frames of the clip with the configured "
+                         "inference and with an FP32 reference, and report latencies and agreement. Default value: "
+                         "0 (no comparison)"));
+            f(_referenceModelPath, "--reference-model-path",
+              args::help("Model the inference is compared with, run in FP32 by OpenCV. Default value: "
+                         "model/MobileNetSSD"));
+            f(_classesSet, "--classes", "-c",
+              args::help("Set of detected classes ID. Default classes: persons and cars"));
+            f(_confCoefficient, "--confidence", "-t",
+              args::help("Model's confidence coefficient. Default value: 0.4"));
+            f(_detectInterval, "--detect-interval",
+              args::help("Minimal number of frames between two detections. Default value: 1"));
+            f(_tileBudget, "--tile-budget",
+              args::help("Network inputs per detected frame, tiles included. Default value: 1 (no tiling)"));
+            f(_trackerThreads, "--tracker-threads",
+              args::help("Number of threads updating object trackers. Default value: 0 (number of CPU cores)"));
+            f(_tracker, "--tracker",
+              args::help("Object tracker: 'dlib', 'mosse' or 'iou'. Default value: dlib"));
+            f(_trackingScale, "--tracking-scale",
+              args::help("Scale of the grayscale image shared by object trackers. Default value: 1"));
+            f(_trackerSkip, "--tracker-skip",
+              args::help("Frames between two updates of trackers of stable objects. Default value: 1"));
+            f(_motionGate, "--motion-gate",
+              args::help("Skip detections of frames without motion"), args::set(true));
+            f(_usePipeline, "--pipeline",
+              args::help("Benchmark pipelined processing instead of the sequential loop"), args::set(true));
+            f(_noEncode, "--no-encode",
+              args::help("Do not encode processed frames"), args::set(true));
+            f(_jsonFileName, "--json",
+              args::help("File the JSON report is written to. By default it is printed to stdout"));
+        }
+
+        void run() {
+            if (1 <= _confCoefficient || _confCoefficient <= 0) {
+                std::cerr << "Incorrect value for model's confidence coefficient. Must be in range(0,1)" << std::endl;
+                return;
+            }
+            if (_frames < 1 || _width < 16 || _height < 16 || _objects < 0) {
+                std::cerr << "Incorrect synthetic clip parameters" << std::endl;
+                return;
+            }
+            if (_detectInterval < 1 || _tileBudget < 1 || _trackerThreads < 0 || 1 < _trackingScale ||
+                _trackingScale <= 0 || _trackerSkip < 1) {
+                std::cerr << "Incorrect detection interval, tile budget, number of tracker threads, tracking scale or "
+                             "tracker skip" << std::endl;
+                return;
+            }
+            InferenceOptions inferenceOptions;
+            if (!parseInferenceBackend(_inferenceBackend, inferenceOptions.backend) ||
+                !parseInferencePrecision(_precision, inferenceOptions.precision) ||
+                !isInferenceSupported(inferenceOptions) || _dnnThreads < 0 || _compareFrames < 0) {
+                std::cerr << "Incorrect inference backend, precision, number of threads or compared frames"
+                          << std::endl;
+                return;
+            }
+            inferenceOptions.threads = _dnnThreads;
+            TrackerBackend trackerBackend;
+            if (!parseTrackerBackend(_tracker, trackerBackend)) {
+                std::cerr << "Incorrect object tracker. Must be 'dlib', 'mosse' or 'iou'" << std::endl;
+                return;
+            }
+            if (_trackerThreads == 0) {
+                _trackerThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+            }
+            if (_classesSet.empty()) {
+                _classesSet = set<int>{
+                        static_cast<int>(ObjectClass::PERSON),
+                        static_cast<int>(ObjectClass::CAR)
+                };
+            }
+
+            auto tmpDir = fs::temp_directory_path();
+            auto clip = _clip;
+            vector<vector<DetectionResult>> groundTruth;
+            if (clip.empty()) {
+                clip = (tmpDir / ("video_tracker_bench_" + std::to_string(_seed) + ".avi")).string();
+                groundTruth = writeSyntheticClip(clip, cv::Size2i(_width, _height), _frames, _objects, _seed);
+                std::clog << "Generated synthetic clip: " << clip << std::endl;
+            }
+            string outFileName = _noEncode ? "" : (tmpDir / "video_tracker_bench_out.avi").string();
+
+            InferenceComparison comparison;
+            if (_compareFrames > 0) {
+                comparison = compareInference(clip, _compareFrames, _referenceModelPath, _modelPath, inferenceOptions,
+                                              makeClassMask(_classesSet), _confCoefficient);
+            }
+
+            Metrics metrics;
+            metrics.setKeepSamples(true);
+            VideoProcessor processor;
+            processor.setInferenceOptions(inferenceOptions);
+            processor.setTiling(TilingOptions{_tileBudget});
+            processor.loadModel(_modelPath, _classesSet, _confCoefficient);
+            processor.setDetectInterval(_detectInterval);
+            processor.setMotionGate(_motionGate, 25);
+            processor.setTrackerThreads(_trackerThreads);
+            processor.setTrackerBackend(trackerBackend);
+            processor.setTrackingScale(_trackingScale);
+            processor.setMotionModel(SpeedEstimator::KALMAN, _trackerSkip);
+            processor.setMetrics(&metrics);
+            processor.openVideoSrc(clip);
+            if (!groundTruth.empty()) {
+                processor.setDetectionSource([&](const uint64_t &seq, vector<DetectionResult> &detectedObjects) {
+                    detectedObjects.clear();
+                    if (seq < groundTruth.size()) {
+                        detectedObjects = groundTruth[seq];
+                    }
+                });
+            }
+            if (_usePipeline) {
+                processor.enablePipeline(4, BackpressurePolicy::BLOCK);
+            }
+            processor.run(outFileName, false);
+
+            std::ofstream jsonFile;
+            if (!_jsonFileName.empty()) {
+                jsonFile.open(_jsonFileName);
+                if (!jsonFile.is_open()) {
+                    std::cerr << "Cannot open JSON report file: " << _jsonFileName << std::endl;
+                    exit(-1);
+                }
+            }
+            std::ostream &out = _jsonFileName.empty() ? std::cout : jsonFile;
+            auto &frameStats = processor.getFrameStats();
+            out << "{\n";
+            out << "  \"clip\": ";
+            writeJsonString(out, _clip.empty() ? "synthetic" : _clip);
+            out << ",\n";
+            out << "  \"seed\": " << _seed << ",\n";
+            out << "  \"detections\": \"" << (groundTruth.empty() ? "model" : "ground_truth") << "\",\n";
+            out << "  \"tracker\": ";
+            writeJsonString(out, _tracker);
+            out << ",\n";
+            out << "  \"tracking_scale\": " << _trackingScale << ",\n";
+            out << "  \"tracker_skip\": " << _trackerSkip << ",\n";
+            out << "  \"tile_budget\": " << _tileBudget << ",\n";
+            out << "  \"inference\": {\"backend\": ";
+            writeJsonString(out, _inferenceBackend);
+            out << ", \"precision\": ";
+            writeJsonString(out, _precision);
+            out << ", \"threads\": " << _dnnThreads << "},\n";
+            if (_compareFrames > 0) {
+                auto ratio = [](const uint64_t &part, const uint64_t &total) {
+                    return total ? double(part) / double(total) : 1.;
+                };
+                out << "  \"inference_comparison\": {\n";
+                out << "    \"reference_model\": ";
+                writeJsonString(out, _referenceModelPath);
+                out << ",\n";
+                out << "    \"reference\": ";
+                writeLatencies(out, comparison.referenceLatencies);
+                out << ",\n    \"candidate\": ";
+                writeLatencies(out, comparison.candidateLatencies);
+                out << ",\n    \"reference_objects\": " << comparison.referenceObjects
+                    << ",\n    \"candidate_objects\": " << comparison.candidateObjects
+                    << ",\n    \"recall\": " << ratio(comparison.matchedObjects, comparison.referenceObjects)
+                    << ",\n    \"precision\": " << ratio(comparison.matchedObjects, comparison.candidateObjects)
+                    << "\n  },\n";
+            }
+            out << "  \"motion_gate\": " << (_motionGate ? "true" : "false") << ",\n";
+            out << "  \"pipeline\": " << (_usePipeline ? "true" : "false") << ",\n";
+            auto &startup = processor.getModelStartup();
+            out << "  \"model_startup\": {\"read_ms\": " << startup.readMs << ", \"setup_ms\": " << startup.setupMs
+                << ", \"warm_up_ms\": " << startup.warmUpMs << "},\n";
+            out << "  \"frames\": " << frameStats.getFrameCount() << ",\n";
+            out << "  \"wall_time_s\": " << frameStats.getWallTime() << ",\n";
+            out << "  \"throughput_fps\": " << frameStats.getThroughput() << ",\n";
+            out << "  \"frame_latency\": {\"count\": " << frameStats.getFrameCount()
+                << ", \"p50_ms\": " << frameStats.percentile(50) << ", \"p95_ms\": " << frameStats.percentile(95)
+                << ", \"p99_ms\": " << frameStats.percentile(99) << "}";
+            out << ",\n  \"stages\": {\n";
+            for (int stage = 0; stage < static_cast<int>(Stage::COUNT); stage++) {
+                out << "    \"" << getStageName(Stage(stage)) << "\": ";
+                writeLatencies(out, metrics.getSamples(Stage(stage)));
+                out << (stage + 1 < static_cast<int>(Stage::COUNT) ? ",\n" : "\n");
+            }
+            out << "  },\n";
+            out << "  \"peak_rss_kb\": " << getPeakRss() << "\n";
+            out << "}" << std::endl;
+
+            if (_clip.empty()) {
+                fs::remove(clip);
+            }
+            if (!outFileName.empty()) {
+                fs::remove(outFileName);
+            }
+            exit(0);
+        }
+    };
+
+} // namespace detector
+
+int main(int argc, char const *argv[]) {
+    args::parse<detector::BenchArgs>(argc, argv);
+}
@@ -0,0 +1,67 @@
+#include "alloc_counter.hpp"
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+namespace detector {
+
+#ifdef VIDEO_TRACKER_COUNT_ALLOCATIONS
+
+    static thread_local uint64_t threadAllocations = 0;
+
+    bool allocationsCounted() {
+        return true;
+    }
+
+    uint64_t getThreadAllocations() {
+        return threadAllocations;
+    }
+
+    static void *countedAlloc(std::size_t size, std::size_t alignment) {
+        threadAllocations++;
+        size = size ? size : 1;
+        void *ptr = alignment > alignof(std::max_align_t)
+                    ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)
+                    : std::malloc(size);
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+#else
+
+    bool allocationsCounted() {
+        return false;
+    }
+
+    uint64_t getThreadAllocations() {
+        return 0;
+    }
+
+#endif
+
+} // namespace detector
+
+#ifdef VIDEO_TRACKER_COUNT_ALLOCATIONS
+
+// The array, nothrow and sized forms of the standard library forward to these.
+
+void *operator new(std::size_t size) {
+    return detector::countedAlloc(size, alignof(std::max_align_t));
+}
+
+void *operator new(std::size_t size, std::align_val_t alignment) {
+    return detector::countedAlloc(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+#endif
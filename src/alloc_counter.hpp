@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+namespace detector {
+
+    // Debug counter of heap allocations made through operator new by the calling thread. It is only
+    // compiled in with VIDEO_TRACKER_COUNT_ALLOCATIONS (cmake -DCOUNT_ALLOCATIONS=ON), which replaces
+    // the global operator new; otherwise nothing is counted.
+    [[nodiscard]] bool allocationsCounted();
+
+    [[nodiscard]] uint64_t getThreadAllocations();
+
+} // namespace detector
@@ -1,4 +1,5 @@
 #include "args.hpp"
+#include "multi_stream.hpp"
 #include "processor.hpp"
 
 using namespace std::chrono;
@@ -6,13 +7,47 @@ using namespace std::chrono;
 namespace detector {
 
     struct Args {
-        string _videoSrc;
+        vector<string> _videoSources;
         string _modelPath = "model/MobileNetSSD";
         string _outputFileName;
         set<int> _classesSet{};
         float _confCoefficient = 0.4;
+        int _inputWidth = 300;
+        int _inputHeight = 300;
+        bool _letterbox = false;
+        int _tileBudget = 1;
+        float _tileOverlap = 0.2;
         bool _useGpu = false;
+        string _inferenceBackend = "opencv";
+        string _precision = "fp32";
+        int _dnnThreads = 0;
         bool _noNamedWindow = false;
+        int _detectInterval = 1;
+        bool _motionGate = false;
+        int _motionThreshold = 25;
+        int _trackerThreads = 0;
+        float _trackingScale = 1.;
+        string _tracker = "dlib";
+        int _historyLength = 2;
+        int _objectTtl = 30;
+        string _speedEstimator = "kalman";
+        int _trackerSkip = 1;
+        string _association = "greedy";
+        float _iouThreshold = 0.3;
+        bool _usePipeline = false;
+        int _queueDepth = 4;
+        string _backpressure = "block";
+        string _captureBackend = "any";
+        int _decodeThreads = 0;
+        int _frameBuffers = 0;
+        vector<string> _roiConfigs;
+        string _metricsFileName;
+        int _metricsInterval = 10;
+        string _dbFileName;
+        int _dbTrackInterval = 1;
+        int _dbBatchRows = 500;
+        int _dbFlushMs = 1000;
+        int _dbQueueSize = 10000;
 
         Args() = default;
 
@@ -22,10 +57,11 @@ namespace detector {
 
         template<class F>
         void parse(F f) {
-            f(_videoSrc, "--video-src", "-v",
-              args::help("Video source (video file, ip camera, video device)"), args::required());
+            f(_videoSources, "--video-src", "-v",
+              args::help("Video sources (video file, ip camera, video device). Several sources are processed "
+                         "in one process sharing a single model"), args::required());
             f(_modelPath, "--model-path", "-m",
-              args::help("MobileNetSSD folder path"));
+              args::help("MobileNetSSD folder path, or an .onnx or OpenVINO IR .xml model file"));
             f(_outputFileName, "--output", "-o",
               args::help("Output file name. By default, processed video stream is not saving"));
             f(_classesSet, "--classes", "-c",
@@ -33,10 +69,128 @@ namespace detector {
                       "Set of detected classes ID. Full set could be found in README. Default classes: persons and cars"));
             f(_confCoefficient, "--confidence", "-t",
               args::help("Model's confidence coefficient. Default value: 0.4"));
+            f(_inputWidth, "--input-width",
+              args::help("Width of the model's input blob. Default value: 300 (MobileNetSSD native size)"));
+            f(_inputHeight, "--input-height",
+              args::help("Height of the model's input blob. Default value: 300 (MobileNetSSD native size)"));
+            f(_letterbox, "--letterbox",
+              args::help("Keep frame's aspect ratio when resizing it to model's input size, padding the rest. "
+                         "By default the frame is stretched"), args::set(true));
+            f(_tileBudget, "--tile-budget",
+              args::help("Network inputs per detected frame: the whole frame plus overlapping tiles, laid out to "
+                         "magnify distant objects as much as this budget allows. Default value: 1 (no tiling)"));
+            f(_tileOverlap, "--tile-overlap",
+              args::help("Share of a tile overlapped by its neighbours. Default value: 0.2"));
             f(_noNamedWindow, "--no-window",
-              args::help("Does not show named window with video stream. False by default"), args::set(true));
+              args::help("Does not show named window with video stream. Frames are then processed as fast as "
+                         "possible until the end of the video source, and throughput and frame latency "
+                         "percentiles are printed at the end. False by default"), args::set(true));
             f(_useGpu, "--cuda",
-              args::help("Use GPU with CUDA"), args::set(true));
+              args::help("Use GPU with CUDA, same as '--inference-backend cuda'"), args::set(true));
+            f(_inferenceBackend, "--inference-backend",
+              args::help("Backend running the model: 'opencv' (OpenCV's own CPU implementation), 'openvino' (Intel's "
+                         "inference engine, if OpenCV was built with it) or 'cuda'. Default value: opencv"));
+            f(_precision, "--precision",
+              args::help("Inference precision: 'fp32', 'fp16' (OpenCV 4.9+ on CPU, or CUDA) or 'int8' (needs a "
+                         "quantized ONNX or OpenVINO IR model as model path, with opencv or openvino). Default "
+                         "value: fp32"));
+            f(_dnnThreads, "--dnn-threads",
+              args::help("Number of threads of OpenCV's parallel loops, inference included. Default value: 0 "
+                         "(OpenCV's default)"));
+            f(_detectInterval, "--detect-interval",
+              args::help("Minimal number of frames between two detections. Detection runs in background "
+                         "as often as the model keeps up. Default value: 1"));
+            f(_motionGate, "--motion-gate",
+              args::help("Skip detections of frames where nothing moved since the last detection and only detect "
+                         "the changed part of the others. False by default"), args::set(true));
+            f(_motionThreshold, "--motion-threshold",
+              args::help("Minimal change of a pixel's gray level for the motion gate to count it as moving. "
+                         "Default value: 25"));
+            f(_trackerThreads, "--tracker-threads",
+              args::help("Number of threads updating object trackers. Default value: 0 (number of CPU cores)"));
+            f(_tracker, "--tracker",
+              args::help("Object tracker: 'dlib' (correlation tracker with scale estimation), 'mosse' (fast "
+                         "fixed size correlation filter) or 'iou' (boxes predicted by a Kalman filter between "
+                         "detections, no image processing). Default value: dlib"));
+            f(_trackingScale, "--tracking-scale",
+              args::help("Scale of the grayscale image shared by object trackers, e.g. 0.5 tracks 1080p input at "
+                         "540p. Default value: 1 (full resolution colour frame)"));
+            f(_historyLength, "--history-length",
+              args::help("Number of last positions kept per object for speed estimation. Default value: 2"));
+            f(_objectTtl, "--object-ttl",
+              args::help("Number of frames after which an object no detection matched is retired, whatever its "
+                         "tracker reports, and for how long the 'iou' tracker predicts boxes without a detection. "
+                         "Frames the motion gate skipped and detections of other parts of the frame do not count. "
+                         "Must be greater than the detection interval. Default value: 30"));
+            f(_speedEstimator, "--speed-estimator",
+              args::help("How speeds are estimated: 'kalman' (velocity of a constant velocity Kalman filter fed by "
+                         "tracker and detector boxes) or 'history' (displacement over the last history-length "
+                         "positions). Default value: kalman"));
+            f(_trackerSkip, "--tracker-skip",
+              args::help("Update trackers of objects moving steadily only every given number of frames, predicting "
+                         "their boxes in between. Default value: 1 (every frame)"));
+            f(_association, "--association",
+              args::help("How detections are matched with tracked objects: 'greedy' (best IoU first) or "
+                         "'hungarian' (optimal assignment). Default value: greedy"));
+            f(_iouThreshold, "--iou-threshold",
+              args::help("Minimal IoU for a detection to be matched with a tracked object. Default value: 0.3"));
+            f(_usePipeline, "--pipeline",
+              args::help("Run capture, tracking, rendering and encoding as separate threads connected by "
+                         "bounded queues"), args::set(true));
+            f(_queueDepth, "--queue-depth",
+              args::help("Capacity of each pipeline queue. Default value: 4"));
+            f(_backpressure, "--backpressure",
+              args::help("What to do when a pipeline queue is full: 'block' the producer or 'drop' the oldest "
+                         "frame. Default value: block"));
+            f(_captureBackend, "--capture-backend",
+              args::help("Video capture backend: 'any' (chosen by OpenCV), 'ffmpeg' or 'gstreamer' (the video source "
+                         "may then be a GStreamer pipeline). Default value: any"));
+            f(_decodeThreads, "--decode-threads",
+              args::help("Number of decoder threads, used by the FFmpeg backend. Default value: 0 (backend's "
+                         "default)"));
+            f(_frameBuffers, "--frame-buffers",
+              args::help("Number of preallocated frames reused by pipelined processing. Default value: 0 (enough "
+                         "for every queue to be full)"));
+            f(_roiConfigs, "--roi-config",
+              args::help("ROI config files, one per video source: polygons restricting detection and tracking, "
+                         "exclusion areas and speed measurement zones. By default the whole frame is used"));
+            f(_metricsFileName, "--metrics-file",
+              args::help("File stage latency histograms and counters are periodically written to, in Prometheus "
+                         "text format. By default metrics are not collected"));
+            f(_metricsInterval, "--metrics-interval",
+              args::help("Seconds between two writes of the metrics file. Default value: 10"));
+            f(_dbFileName, "--db",
+              args::help("SQLite database tracks and speed events are recorded into by a background writer. By "
+                         "default nothing is recorded"));
+            f(_dbTrackInterval, "--db-track-interval",
+              args::help("Record the positions of tracked objects every given number of frames. Default value: 1"));
+            f(_dbBatchRows, "--db-batch-rows",
+              args::help("Number of events written to the database per transaction. Default value: 500"));
+            f(_dbFlushMs, "--db-flush-ms",
+              args::help("Milliseconds after which fewer events than a batch are written anyway. Default value: "
+                         "1000"));
+            f(_dbQueueSize, "--db-queue-size",
+              args::help("Number of events waiting for the database writer, beyond which new track points are "
+                         "dropped. Default value: 10000"));
+        }
+
+        template<class Processor>
+        void configure(Processor &processor, const AssociationMethod &associationMethod,
+                       const TrackerBackend &trackerBackend, const SpeedEstimator &speedEstimator,
+                       const CaptureOptions &captureOptions, const InferenceOptions &inferenceOptions) {
+            processor.setCaptureOptions(captureOptions);
+            processor.setInferenceOptions(inferenceOptions);
+            processor.setModelInputSize(cv::Size2i(_inputWidth, _inputHeight), _letterbox);
+            processor.setTiling(TilingOptions{_tileBudget, _tileOverlap});
+            processor.loadModel(_modelPath, _classesSet, _confCoefficient);
+            processor.setDetectInterval(_detectInterval);
+            processor.setMotionGate(_motionGate, _motionThreshold);
+            processor.setTrackerThreads(_trackerThreads);
+            processor.setTrackerBackend(trackerBackend);
+            processor.setTrackingScale(_trackingScale);
+            processor.setHistoryLimits(_historyLength, _objectTtl);
+            processor.setMotionModel(speedEstimator, _trackerSkip);
+            processor.setAssociation(associationMethod, _iouThreshold);
         }
 
         void run() {
@@ -44,26 +198,258 @@ namespace detector {
                 std::cerr << "Incorrect value for model's confidence coefficient. Must be in range(0,1)" << std::endl;
                 return;
             }
+            if (_inputWidth < 1 || _inputHeight < 1) {
+                std::cerr << "Incorrect model's input size. Width and height must be positive" << std::endl;
+                return;
+            }
+            if (_tileBudget < 1) {
+                std::cerr << "Incorrect tile budget. Must be positive" << std::endl;
+                return;
+            }
+            if (_tileOverlap < 0 || _tileOverlap >= 0.9) {
+                std::cerr << "Incorrect value for tile overlap. Must be in range[0,0.9)" << std::endl;
+                return;
+            }
+            if (_useGpu && _inferenceBackend == "opencv") {
+                _inferenceBackend = "cuda";
+            }
+            InferenceOptions inferenceOptions;
+            if (!parseInferenceBackend(_inferenceBackend, inferenceOptions.backend)) {
+                std::cerr << "Incorrect inference backend. Must be 'opencv', 'openvino' or 'cuda'" << std::endl;
+                return;
+            }
+            if (!parseInferencePrecision(_precision, inferenceOptions.precision)) {
+                std::cerr << "Incorrect inference precision. Must be 'fp32', 'fp16' or 'int8'" << std::endl;
+                return;
+            }
+            if (!isInferenceSupported(inferenceOptions)) {
+                std::cerr << "Inference precision " << _precision << " is not supported by the "
+                          << _inferenceBackend << " backend" << std::endl;
+                return;
+            }
+            if (_dnnThreads < 0) {
+                std::cerr << "Incorrect number of inference threads. Must be non-negative" << std::endl;
+                return;
+            }
+            inferenceOptions.threads = _dnnThreads;
+            SpeedEstimator speedEstimator;
+            if (!parseSpeedEstimator(_speedEstimator, speedEstimator)) {
+                std::cerr << "Incorrect speed estimator. Must be 'kalman' or 'history'" << std::endl;
+                return;
+            }
+            if (_trackerSkip < 1) {
+                std::cerr << "Incorrect tracker skip. Must be positive" << std::endl;
+                return;
+            }
+            AssociationMethod associationMethod;
+            if (!parseAssociationMethod(_association, associationMethod)) {
+                std::cerr << "Incorrect association method. Must be 'greedy' or 'hungarian'" << std::endl;
+                return;
+            }
+            if (1 < _iouThreshold || _iouThreshold <= 0) {
+                std::cerr << "Incorrect value for IoU threshold. Must be in range(0,1]" << std::endl;
+                return;
+            }
+            BackpressurePolicy backpressurePolicy;
+            if (!parseBackpressurePolicy(_backpressure, backpressurePolicy)) {
+                std::cerr << "Incorrect backpressure policy. Must be 'block' or 'drop'" << std::endl;
+                return;
+            }
+            if (_detectInterval < 1) {
+                std::cerr << "Incorrect value for detection interval. Must be positive" << std::endl;
+                return;
+            }
+            if (_motionThreshold < 1 || _motionThreshold > 254) {
+                std::cerr << "Incorrect motion threshold. Must be in range [1,254]" << std::endl;
+                return;
+            }
+            if (_trackerThreads < 0) {
+                std::cerr << "Incorrect number of tracker threads. Must be non-negative" << std::endl;
+                return;
+            }
+            if (_trackerThreads == 0) {
+                _trackerThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+            }
+            TrackerBackend trackerBackend;
+            if (!parseTrackerBackend(_tracker, trackerBackend)) {
+                std::cerr << "Incorrect object tracker. Must be 'dlib', 'mosse' or 'iou'" << std::endl;
+                return;
+            }
+            if (1 < _trackingScale || _trackingScale <= 0) {
+                std::cerr << "Incorrect value for tracking scale. Must be in range(0,1]" << std::endl;
+                return;
+            }
+            if (_historyLength < 2) {
+                std::cerr << "Incorrect history length. Must be at least 2" << std::endl;
+                return;
+            }
+            if (_objectTtl <= _detectInterval) {
+                std::cerr << "Incorrect object TTL. Must be greater than the detection interval" << std::endl;
+                return;
+            }
+            if (_queueDepth < 1) {
+                std::cerr << "Incorrect value for pipeline queue depth. Must be positive" << std::endl;
+                return;
+            }
+            CaptureOptions captureOptions;
+            if (!parseCaptureBackend(_captureBackend, captureOptions.backend)) {
+                std::cerr << "Incorrect capture backend. Must be 'any', 'ffmpeg' or 'gstreamer'" << std::endl;
+                return;
+            }
+            if (_decodeThreads < 0 || _frameBuffers < 0) {
+                std::cerr << "Incorrect number of decoder threads or frame buffers. Must be non-negative" << std::endl;
+                return;
+            }
+            if (_frameBuffers > 0 && _frameBuffers < 2) {
+                std::cerr << "Incorrect number of frame buffers. Pipelined processing needs at least 2" << std::endl;
+                return;
+            }
+            captureOptions.decodeThreads = _decodeThreads;
+            captureOptions.frameBuffers = _frameBuffers;
+            if (!_roiConfigs.empty() && _roiConfigs.size() != _videoSources.size()) {
+                std::cerr << "Incorrect number of ROI configs. Must be one per video source" << std::endl;
+                return;
+            }
+            if (_metricsInterval < 1) {
+                std::cerr << "Incorrect metrics interval. Must be positive" << std::endl;
+                return;
+            }
+            if (_dbTrackInterval < 1 || _dbBatchRows < 1 || _dbFlushMs < 1) {
+                std::cerr << "Incorrect database track interval, batch rows or flush interval. Must be positive"
+                          << std::endl;
+                return;
+            }
+            if (_dbQueueSize < _dbBatchRows) {
+                std::cerr << "Incorrect database queue size. Must be at least the batch rows" << std::endl;
+                return;
+            }
             if (_classesSet.empty()) {
                 _classesSet = set<int>{
                         static_cast<int>(ObjectClass::PERSON),
                         static_cast<int>(ObjectClass::CAR)
                 };
             }
-            if (_useGpu) {
+            if (inferenceOptions.backend == InferenceBackend::CUDA) {
                 cv::cuda::setDevice(cv::cuda::getDevice());
             }
-            std::cout << "Video source: " << _videoSrc << std::endl;
-            std::cout << "Output file: " << (_outputFileName.empty() ? "no" : _outputFileName) << std::endl;
+            for (auto &videoSrc: _videoSources) {
+                std::cout << "Video source: " << videoSrc << std::endl;
+            }
+            std::cout << "Output file: " << (_outputFileName.empty() ? "no" : _outputFileName)
+                      << (_videoSources.size() > 1 && !_outputFileName.empty() ? " (suffixed with source index)" : "")
+                      << std::endl;
             std::cout << "MobileNetSSD folder path: " << _modelPath << std::endl;
             std::cout << "Model's confidence coefficient: " << _confCoefficient << std::endl;
+            std::cout << "Model's input size: " << _inputWidth << " x " << _inputHeight
+                      << (_letterbox ? " (letterbox)" : " (resize)") << std::endl;
+            std::cout << "Detection tiles: " << (_tileBudget > 1 ? "up to " + std::to_string(_tileBudget - 1) : "no");
+            if (_tileBudget > 1) {
+                std::cout << ", overlap: " << _tileOverlap;
+            }
+            std::cout << std::endl;
             std::cout << "Show named window with video stream: " << !_noNamedWindow << std::endl;
-            std::cout << "Use GPU (CUDA): " << _useGpu << std::endl;
+            std::cout << "Inference backend: " << _inferenceBackend << ", precision: " << _precision
+                      << ", threads: " << (_dnnThreads ? std::to_string(_dnnThreads) : "auto") << std::endl;
+            std::cout << "Minimal detection interval (frames): " << _detectInterval << std::endl;
+            std::cout << "Motion gate: " << _motionGate;
+            if (_motionGate) {
+                std::cout << ", threshold: " << _motionThreshold;
+            }
+            std::cout << std::endl;
+            std::cout << "Object tracker: " << _tracker << ", threads: " << _trackerThreads
+                      << ", tracking scale: " << _trackingScale << std::endl;
+            std::cout << "Object history length: " << _historyLength << ", TTL (frames): " << _objectTtl << std::endl;
+            std::cout << "Speed estimator: " << _speedEstimator << ", tracker skip (frames): " << _trackerSkip
+                      << std::endl;
+            std::cout << "Association: " << _association << ", IoU threshold: " << _iouThreshold << std::endl;
+            std::cout << "Pipelined processing: " << _usePipeline << std::endl;
+            if (_usePipeline) {
+                std::cout << "Pipeline queue depth: " << _queueDepth << ", backpressure: " << _backpressure << std::endl;
+            }
+            std::cout << "Capture backend: " << _captureBackend << ", decoder threads: "
+                      << (_decodeThreads ? std::to_string(_decodeThreads) : "auto") << std::endl;
+            if (_usePipeline) {
+                std::cout << "Frame buffers: " << (_frameBuffers ? std::to_string(_frameBuffers) : "auto") << std::endl;
+            }
+            for (auto &roiConfig: _roiConfigs) {
+                std::cout << "ROI config: " << roiConfig << std::endl;
+            }
+            std::cout << "Metrics file: " << (_metricsFileName.empty() ? "no" : _metricsFileName);
+            if (!_metricsFileName.empty()) {
+                std::cout << ", written every " << _metricsInterval << " s";
+            }
+            std::cout << std::endl;
+            std::cout << "Event database: " << (_dbFileName.empty() ? "no" : _dbFileName);
+            if (!_dbFileName.empty()) {
+                std::cout << ", track interval: " << _dbTrackInterval << ", batch rows: " << _dbBatchRows
+                          << ", flush interval: " << _dbFlushMs << " ms, queue size: " << _dbQueueSize;
+            }
+            std::cout << std::endl;
 
-            VideoProcessor processor;
-            processor.loadModel(_modelPath, _classesSet, _confCoefficient);
-            processor.openVideoSrc(_videoSrc);
-            processor.run(_outputFileName, !_noNamedWindow);
+            {
+                // Declared before the processors so that the last dump happens after processing has stopped.
+                Metrics metrics;
+                std::unique_ptr<MetricsDumper> metricsDumper;
+                if (!_metricsFileName.empty()) {
+                    metricsDumper = std::make_unique<MetricsDumper>(metrics, _metricsFileName,
+                                                                    seconds(_metricsInterval));
+                }
+                auto metricsPtr = metricsDumper ? &metrics : nullptr;
+                // Likewise, the writer commits the last events once the processors are gone.
+                std::unique_ptr<EventWriter> eventWriter;
+                if (!_dbFileName.empty()) {
+                    EventWriterOptions eventWriterOptions;
+                    eventWriterOptions.trackInterval = _dbTrackInterval;
+                    eventWriterOptions.batchRows = _dbBatchRows;
+                    eventWriterOptions.flushInterval = milliseconds(_dbFlushMs);
+                    eventWriterOptions.queueCapacity = _dbQueueSize;
+                    try {
+                        eventWriter = std::make_unique<EventWriter>(_dbFileName, eventWriterOptions, metricsPtr);
+                    } catch (const DBException &e) {
+                        std::cerr << "Cannot open event database " << _dbFileName << ": " << e.what() << std::endl;
+                        exit(-1);
+                    }
+                }
+
+                if (_videoSources.size() > 1) {
+                    if (_usePipeline) {
+                        std::cerr << "Pipelined processing is not supported for several video sources, ignoring it"
+                                  << std::endl;
+                    }
+                    MultiStreamProcessor processor;
+                    configure(processor, associationMethod, trackerBackend, speedEstimator, captureOptions,
+                              inferenceOptions);
+                    processor.setMetrics(metricsPtr);
+                    processor.setEventWriter(eventWriter.get());
+                    processor.setRoiConfigs(_roiConfigs);
+                    try {
+                        processor.openVideoSources(_videoSources);
+                    } catch (const std::runtime_error &e) {
+                        std::cerr << e.what() << std::endl;
+                        return;
+                    }
+                    processor.run(_outputFileName, !_noNamedWindow);
+                } else {
+                    VideoProcessor processor;
+                    configure(processor, associationMethod, trackerBackend, speedEstimator, captureOptions,
+                              inferenceOptions);
+                    processor.setMetrics(metricsPtr);
+                    processor.setEventWriter(eventWriter.get());
+                    if (!_roiConfigs.empty()) {
+                        processor.setRoiConfig(_roiConfigs.front());
+                    }
+                    try {
+                        processor.openVideoSrc(_videoSources.front());
+                    } catch (const std::runtime_error &e) {
+                        std::cerr << e.what() << std::endl;
+                        return;
+                    }
+                    if (_usePipeline) {
+                        processor.enablePipeline(_queueDepth, backpressurePolicy);
+                    }
+                    processor.run(_outputFileName, !_noNamedWindow);
+                }
+            }
 
             exit(0);
         }
@@ -0,0 +1,270 @@
+#include "association.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+namespace detector {
+
+    // Cost of an assignment that is not a candidate pair. It is larger than any sum of real costs
+    // (1 - IoU <= 1 each), so the solver first maximises the number of real matches.
+    const double noMatchCost = 1e6;
+
+    bool parseAssociationMethod(const string &name, AssociationMethod &method) {
+        if (name == "greedy") {
+            method = AssociationMethod::GREEDY;
+        } else if (name == "hungarian") {
+            method = AssociationMethod::HUNGARIAN;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    double iou(const cv::Rect2i &a, const cv::Rect2i &b) {
+        auto intersection = (a & b).area();
+        if (intersection <= 0) {
+            return 0.;
+        }
+        return double(intersection) / double(a.area() + b.area() - intersection);
+    }
+
+    // Minimal cost assignment of every row to a distinct column of a nRows x nCols cost matrix,
+    // nRows <= nCols (Hungarian algorithm with potentials, O(nRows^2 * nCols)).
+    static void solveAssignment(const std::pmr::vector<double> &cost, const int &nRows, const int &nCols,
+                                std::pmr::vector<int> &rowToCol, std::pmr::memory_resource *scratch) {
+        const double inf = std::numeric_limits<double>::infinity();
+        std::pmr::vector<double> u(nRows + 1, 0., scratch), v(nCols + 1, 0., scratch), minv(nCols + 1, 0., scratch);
+        std::pmr::vector<int> p(nCols + 1, 0, scratch), way(nCols + 1, 0, scratch);
+        std::pmr::vector<char> used(nCols + 1, 0, scratch);
+        for (int i = 1; i <= nRows; i++) {
+            p[0] = i;
+            int j0 = 0;
+            std::fill(minv.begin(), minv.end(), inf);
+            std::fill(used.begin(), used.end(), 0);
+            do {
+                used[j0] = 1;
+                int i0 = p[j0];
+                int j1 = 0;
+                double delta = inf;
+                for (int j = 1; j <= nCols; j++) {
+                    if (!used[j]) {
+                        double cur = cost[(i0 - 1) * nCols + (j - 1)] - u[i0] - v[j];
+                        if (cur < minv[j]) {
+                            minv[j] = cur;
+                            way[j] = j0;
+                        }
+                        if (minv[j] < delta) {
+                            delta = minv[j];
+                            j1 = j;
+                        }
+                    }
+                }
+                for (int j = 0; j <= nCols; j++) {
+                    if (used[j]) {
+                        u[p[j]] += delta;
+                        v[j] -= delta;
+                    } else {
+                        minv[j] -= delta;
+                    }
+                }
+                j0 = j1;
+            } while (p[j0] != 0);
+            do {
+                int j1 = way[j0];
+                p[j0] = p[j1];
+                j0 = j1;
+            } while (j0);
+        }
+        rowToCol.assign(nRows, -1);
+        for (int j = 1; j <= nCols; j++) {
+            if (p[j]) {
+                rowToCol[p[j] - 1] = j - 1;
+            }
+        }
+    }
+
+    static int findRoot(std::pmr::vector<int> &parents, int node) {
+        while (parents[node] != node) {
+            parents[node] = parents[parents[node]];
+            node = parents[node];
+        }
+        return node;
+    }
+
+    cv::Rect2i UniformGrid::cellRange(const cv::Rect2i &rect) const {
+        auto clipped = rect & _bounds;
+        if (clipped.width <= 0 || clipped.height <= 0) {
+            return cv::Rect2i();
+        }
+        int col0 = (clipped.x - _bounds.x) / _cellSize;
+        int row0 = (clipped.y - _bounds.y) / _cellSize;
+        int col1 = std::min((clipped.x + clipped.width - 1 - _bounds.x) / _cellSize, _cols - 1);
+        int row1 = std::min((clipped.y + clipped.height - 1 - _bounds.y) / _cellSize, _rows - 1);
+        return cv::Rect2i(col0, row0, col1 - col0 + 1, row1 - row0 + 1);
+    }
+
+    void UniformGrid::build(const vector<cv::Rect2i> &rects, std::pmr::memory_resource *scratch) {
+        _cols = _rows = 0;
+        _visited.assign(rects.size(), 0);
+        _queryStamp = 0;
+        if (rects.empty()) {
+            return;
+        }
+
+        // Cells about twice the average box size keep most boxes within 2x2 cells.
+        _bounds = rects.front();
+        double meanSide = 0.;
+        for (auto &rect: rects) {
+            _bounds |= rect;
+            meanSide += std::max(rect.width, rect.height);
+        }
+        meanSide /= double(rects.size());
+        const int maxCellsPerSide = 256;
+        _cellSize = std::max({16, static_cast<int>(2 * meanSide),
+                              _bounds.width / maxCellsPerSide + 1, _bounds.height / maxCellsPerSide + 1});
+        _cols = _bounds.width / _cellSize + 1;
+        _rows = _bounds.height / _cellSize + 1;
+
+        _cellStarts.assign(_cols * _rows + 1, 0);
+        for (auto &rect: rects) {
+            auto range = cellRange(rect);
+            for (int row = range.y; row < range.y + range.height; row++) {
+                for (int col = range.x; col < range.x + range.width; col++) {
+                    _cellStarts[row * _cols + col + 1]++;
+                }
+            }
+        }
+        std::partial_sum(_cellStarts.begin(), _cellStarts.end(), _cellStarts.begin());
+        _items.resize(_cellStarts.back());
+        std::pmr::vector<int> cellFill(_cellStarts.begin(), _cellStarts.end() - 1, scratch);
+        for (int i = 0; i < static_cast<int>(rects.size()); i++) {
+            auto range = cellRange(rects[i]);
+            for (int row = range.y; row < range.y + range.height; row++) {
+                for (int col = range.x; col < range.x + range.width; col++) {
+                    _items[cellFill[row * _cols + col]++] = i;
+                }
+            }
+        }
+    }
+
+    void Associator::configure(const AssociationMethod &method, const double &minIou) {
+        _method = method;
+        _minIou = minIou;
+    }
+
+    void Associator::associate(const vector<cv::Rect2i> &detections, const vector<cv::Rect2i> &tracks,
+                               vector<int> &detectionToTrack, std::pmr::memory_resource *scratch) {
+        detectionToTrack.assign(detections.size(), -1);
+        if (detections.empty() || tracks.empty()) {
+            return;
+        }
+
+        _grid.build(tracks, scratch);
+        _candidates.clear();
+        for (int detection = 0; detection < static_cast<int>(detections.size()); detection++) {
+            _grid.query(detections[detection], [&](int track) {
+                auto overlap = iou(detections[detection], tracks[track]);
+                if (overlap >= _minIou && overlap > 0.) {
+                    _candidates.push_back(Candidate{detection, track, overlap});
+                }
+            });
+        }
+
+        std::pmr::vector<int> trackToDetection(tracks.size(), -1, scratch);
+        if (_method == AssociationMethod::HUNGARIAN) {
+            assignHungarian(detections.size(), tracks.size(), detectionToTrack, trackToDetection, scratch);
+        } else {
+            assignGreedy(detectionToTrack, trackToDetection);
+        }
+    }
+
+    void Associator::assignGreedy(vector<int> &detectionToTrack, std::pmr::vector<int> &trackToDetection) {
+        std::sort(_candidates.begin(), _candidates.end(), [](const Candidate &a, const Candidate &b) {
+            if (a.iou != b.iou) {
+                return a.iou > b.iou;
+            }
+            return a.detection != b.detection ? a.detection < b.detection : a.track < b.track;
+        });
+        for (auto &candidate: _candidates) {
+            if (detectionToTrack[candidate.detection] == -1 && trackToDetection[candidate.track] == -1) {
+                detectionToTrack[candidate.detection] = candidate.track;
+                trackToDetection[candidate.track] = candidate.detection;
+            }
+        }
+    }
+
+    void Associator::assignHungarian(const size_t &nDetections, const size_t &nTracks, vector<int> &detectionToTrack,
+                                     std::pmr::vector<int> &trackToDetection, std::pmr::memory_resource *scratch) {
+        // Detections are nodes [0, nDetections), tracks follow them. Boxes that share no candidate
+        // pair can never influence each other's assignment, so each connected group is solved alone.
+        std::pmr::vector<int> parents(nDetections + nTracks, 0, scratch);
+        std::iota(parents.begin(), parents.end(), 0);
+        for (auto &candidate: _candidates) {
+            auto a = findRoot(parents, candidate.detection);
+            auto b = findRoot(parents, static_cast<int>(nDetections) + candidate.track);
+            if (a != b) {
+                parents[a] = b;
+            }
+        }
+        std::sort(_candidates.begin(), _candidates.end(), [&](const Candidate &a, const Candidate &b) {
+            auto rootA = findRoot(parents, a.detection);
+            auto rootB = findRoot(parents, b.detection);
+            return rootA != rootB ? rootA < rootB : a.detection < b.detection;
+        });
+
+        std::pmr::vector<int> rowIndex(nDetections, -1, scratch), colIndex(nTracks, -1, scratch);
+        std::pmr::vector<int> rows(scratch), cols(scratch), rowToCol(scratch);
+        std::pmr::vector<double> cost(scratch);
+        for (size_t first = 0; first < _candidates.size();) {
+            auto root = findRoot(parents, _candidates[first].detection);
+            auto last = first;
+            rows.clear();
+            cols.clear();
+            while (last < _candidates.size() && findRoot(parents, _candidates[last].detection) == root) {
+                auto &candidate = _candidates[last];
+                if (rowIndex[candidate.detection] == -1) {
+                    rowIndex[candidate.detection] = static_cast<int>(rows.size());
+                    rows.push_back(candidate.detection);
+                }
+                if (colIndex[candidate.track] == -1) {
+                    colIndex[candidate.track] = static_cast<int>(cols.size());
+                    cols.push_back(candidate.track);
+                }
+                last++;
+            }
+
+            // The solver wants no more rows than columns, transpose the group if needed.
+            bool transposed = rows.size() > cols.size();
+            int nRows = static_cast<int>(transposed ? cols.size() : rows.size());
+            int nCols = static_cast<int>(transposed ? rows.size() : cols.size());
+            cost.assign(nRows * nCols, noMatchCost);
+            for (auto i = first; i < last; i++) {
+                auto &candidate = _candidates[i];
+                auto row = rowIndex[candidate.detection];
+                auto col = colIndex[candidate.track];
+                cost[transposed ? col * nCols + row : row * nCols + col] = 1. - candidate.iou;
+            }
+            solveAssignment(cost, nRows, nCols, rowToCol, scratch);
+            for (int row = 0; row < nRows; row++) {
+                auto col = rowToCol[row];
+                if (col < 0 || cost[row * nCols + col] >= noMatchCost) {
+                    continue;
+                }
+                auto detection = transposed ? rows[col] : rows[row];
+                auto track = transposed ? cols[row] : cols[col];
+                detectionToTrack[detection] = track;
+                trackToDetection[track] = detection;
+            }
+
+            for (auto detection: rows) {
+                rowIndex[detection] = -1;
+            }
+            for (auto track: cols) {
+                colIndex[track] = -1;
+            }
+            first = last;
+        }
+    }
+
+} // namespace detector
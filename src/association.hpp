@@ -0,0 +1,114 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+#include "model.hpp"
+
+namespace detector {
+
+    enum class AssociationMethod : int {
+        GREEDY = 0,
+        HUNGARIAN
+    };
+
+    bool parseAssociationMethod(const string &name, AssociationMethod &method);
+
+    [[nodiscard]] double iou(const cv::Rect2i &a, const cv::Rect2i &b);
+
+    // Uniform grid over a set of boxes: every box is registered in each cell it overlaps, so a query
+    // only has to look at boxes sharing a cell with the query box instead of at all of them.
+    class UniformGrid {
+    private:
+
+        cv::Rect2i _bounds;
+        int _cellSize = 1;
+        int _cols = 0;
+        int _rows = 0;
+
+        // Cell contents in compressed form: items of cell c are _items[_cellStarts[c] .. _cellStarts[c + 1]).
+        vector<int> _cellStarts;
+        vector<int> _items;
+
+        // Query-local deduplication of boxes spanning several cells.
+        mutable vector<uint32_t> _visited;
+        mutable uint32_t _queryStamp = 0;
+
+        [[nodiscard]] cv::Rect2i cellRange(const cv::Rect2i &rect) const;
+
+    public:
+
+        void build(const vector<cv::Rect2i> &rects,
+                   std::pmr::memory_resource *scratch = std::pmr::get_default_resource());
+
+        // Calls f(index) once for every registered box sharing at least one cell with rect.
+        template<class F>
+        void query(const cv::Rect2i &rect, F &&f) const {
+            if (_cols == 0) {
+                return;
+            }
+            auto range = cellRange(rect);
+            if (range.empty()) {
+                return;
+            }
+            if (++_queryStamp == 0) {
+                std::fill(_visited.begin(), _visited.end(), 0);
+                _queryStamp = 1;
+            }
+            for (int row = range.y; row < range.y + range.height; row++) {
+                for (int col = range.x; col < range.x + range.width; col++) {
+                    auto cell = row * _cols + col;
+                    for (int i = _cellStarts[cell]; i < _cellStarts[cell + 1]; i++) {
+                        auto item = _items[i];
+                        if (_visited[item] != _queryStamp) {
+                            _visited[item] = _queryStamp;
+                            f(item);
+                        }
+                    }
+                }
+            }
+        }
+
+    };
+
+    // Matches detections to tracked boxes one-to-one by IoU. Candidate pairs are pruned with a
+    // uniform grid and pairs below the IoU threshold are never matched. The assignment itself is
+    // either greedy (best IoU first) or optimal (Hungarian algorithm on every connected group of
+    // candidate pairs), which keeps the cubic part small even in crowded scenes.
+    class Associator {
+    private:
+
+        struct Candidate {
+            int detection;
+            int track;
+            double iou;
+        };
+
+        AssociationMethod _method = AssociationMethod::GREEDY;
+        double _minIou = 0.3;
+
+        UniformGrid _grid;
+        vector<Candidate> _candidates;
+
+        void assignGreedy(vector<int> &detectionToTrack, std::pmr::vector<int> &trackToDetection);
+
+        void assignHungarian(const size_t &nDetections, const size_t &nTracks, vector<int> &detectionToTrack,
+                             std::pmr::vector<int> &trackToDetection, std::pmr::memory_resource *scratch);
+
+    public:
+
+        void configure(const AssociationMethod &method, const double &minIou);
+
+        [[nodiscard]] double minIou() const { return _minIou; }
+
+        // detectionToTrack[i] is set to the index of the track matched with detection i, or -1.
+        // Temporary buffers come from scratch, which may be a per-frame arena.
+        void associate(const vector<cv::Rect2i> &detections, const vector<cv::Rect2i> &tracks,
+                       vector<int> &detectionToTrack,
+                       std::pmr::memory_resource *scratch = std::pmr::get_default_resource());
+
+    };
+
+} // namespace detector
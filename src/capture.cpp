@@ -0,0 +1,122 @@
+#include "capture.hpp"
+
+#include <cmath>
+
+namespace detector {
+
+    bool parseCaptureBackend(const string &name, CaptureBackend &backend) {
+        if (name == "any") {
+            backend = CaptureBackend::ANY;
+        } else if (name == "ffmpeg") {
+            backend = CaptureBackend::FFMPEG;
+        } else if (name == "gstreamer") {
+            backend = CaptureBackend::GSTREAMER;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    bool openCapture(cv::VideoCapture &cap, const string &videoSrc, const CaptureOptions &options) {
+        switch (options.backend) {
+            case CaptureBackend::FFMPEG: {
+                vector<int> params;
+                if (options.decodeThreads > 0) {
+                    params = {cv::CAP_PROP_N_THREADS, options.decodeThreads};
+                }
+                cap.open(videoSrc, cv::CAP_FFMPEG, params);
+                break;
+            }
+            case CaptureBackend::GSTREAMER:
+                cap.open(videoSrc, cv::CAP_GSTREAMER);
+                break;
+            default:
+                cap.open(videoSrc);
+                if (cap.isOpened() && options.decodeThreads > 0) {
+                    // Only some backends support it, the others keep their own default.
+                    cap.set(cv::CAP_PROP_N_THREADS, options.decodeThreads);
+                }
+        }
+        if (cap.isOpened()) {
+            std::clog << "Capture backend: " << cap.getBackendName() << std::endl;
+        }
+        return cap.isOpened();
+    }
+
+    static constexpr double periodSmoothing = 0.1;
+
+    void SourceFrameRate::reset(const cv::VideoCapture &cap) {
+        _sourceFps = cap.get(cv::CAP_PROP_FPS);
+        // Backends that do not know it report 0, a few of them absurd values.
+        if (!std::isfinite(_sourceFps) || _sourceFps <= 0. || _sourceFps > 1000.) {
+            _sourceFps = 0.;
+        }
+        _periodUs = 0.;
+        _hasCaptureTime = false;
+        std::clog << "Source frame rate: ";
+        if (_sourceFps > 0.) {
+            std::clog << _sourceFps << " FPS" << std::endl;
+        } else {
+            std::clog << "unknown, measured from capture times" << std::endl;
+        }
+    }
+
+    void SourceFrameRate::addFrame(const std::chrono::steady_clock::time_point &captureTime) {
+        if (_hasCaptureTime) {
+            auto periodUs = std::max(
+                    1., std::chrono::duration<double, std::micro>(captureTime - _lastCaptureTime).count());
+            _periodUs = _periodUs > 0. ? _periodUs + periodSmoothing * (periodUs - _periodUs) : periodUs;
+        }
+        _lastCaptureTime = captureTime;
+        _hasCaptureTime = true;
+    }
+
+    double SourceFrameRate::get() const {
+        if (_sourceFps > 0.) {
+            return _sourceFps;
+        }
+        return _periodUs > 0. ? 1000000. / _periodUs : 0.;
+    }
+
+    FramePool::FramePool(const size_t &count, const cv::Size2i &frameSize, const int &type) {
+        for (size_t i = 0; i < count; i++) {
+            _buffers.emplace_back(frameSize, type);
+            _freeBuffers.push_back(i);
+        }
+    }
+
+    void FramePool::release(const size_t &buffer) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _freeBuffers.push_back(buffer);
+        }
+        _freeCond.notify_one();
+    }
+
+    bool FramePool::acquire(cv::Mat &frame, std::shared_ptr<void> &lease) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _freeCond.wait(lock, [this] { return _closed || !_freeBuffers.empty(); });
+        if (_closed) {
+            return false;
+        }
+        auto buffer = _freeBuffers.back();
+        _freeBuffers.pop_back();
+        // Only the header is copied: the frame shares data with the pooled buffer. VideoCapture::read still
+        // copies the decoded picture from the backend's own buffer into it, but without reallocating it
+        // as long as the stream keeps its size.
+        frame = _buffers[buffer];
+        lease = std::shared_ptr<void>(nullptr, [this, buffer](void *) {
+            release(buffer);
+        });
+        return true;
+    }
+
+    void FramePool::close() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _closed = true;
+        }
+        _freeCond.notify_all();
+    }
+
+} // namespace detector
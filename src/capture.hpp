@@ -0,0 +1,86 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+
+#include "model.hpp"
+
+namespace detector {
+
+    enum class CaptureBackend : int {
+        ANY = 0,
+        FFMPEG,
+        GSTREAMER
+    };
+
+    bool parseCaptureBackend(const string &name, CaptureBackend &backend);
+
+    struct CaptureOptions {
+        CaptureBackend backend = CaptureBackend::ANY;
+        // 0 leaves the number of decoder threads to the backend.
+        int decodeThreads = 0;
+        // 0 sizes the frame pool after the pipeline queues.
+        size_t frameBuffers = 0;
+    };
+
+    // Opens videoSrc with the requested backend. The decoder thread count is passed to FFmpeg;
+    // GStreamer sources are expected to be full pipelines that configure their decoder themselves.
+    bool openCapture(cv::VideoCapture &cap, const string &videoSrc, const CaptureOptions &options);
+
+    // Frame rate speeds are converted with: the one the video source reports, or for sources reporting
+    // none, such as some cameras, the smoothed period frames were captured at. The time spent processing
+    // a frame says nothing about the time that passed between two frames of the scene.
+    class SourceFrameRate {
+    private:
+
+        double _sourceFps = 0.;
+        double _periodUs = 0.;
+        std::chrono::steady_clock::time_point _lastCaptureTime;
+        bool _hasCaptureTime = false;
+
+    public:
+
+        void reset(const cv::VideoCapture &cap);
+
+        void addFrame(const std::chrono::steady_clock::time_point &captureTime);
+
+        // 0 until the source reported a frame rate or two frames were captured.
+        [[nodiscard]] double get() const;
+
+    };
+
+    // Fixed set of preallocated frames reused for the whole run, so decoding does not allocate a new
+    // frame for every packet in flight. acquire() hands out a frame together with a lease; the frame
+    // goes back to the pool once the last copy of the lease is destroyed, wherever down the pipeline
+    // that happens. A frame must not be used after its lease is gone.
+    class FramePool {
+    private:
+
+        vector<cv::Mat> _buffers;
+        vector<size_t> _freeBuffers;
+        bool _closed = false;
+
+        std::mutex _mutex;
+        std::condition_variable _freeCond;
+
+        void release(const size_t &buffer);
+
+    public:
+
+        FramePool(const size_t &count, const cv::Size2i &frameSize, const int &type);
+
+        FramePool(const FramePool &) = delete;
+
+        FramePool &operator=(const FramePool &) = delete;
+
+        // Blocks while every frame is leased. Returns false once the pool is closed.
+        bool acquire(cv::Mat &frame, std::shared_ptr<void> &lease);
+
+        // Wakes up and fails every waiting acquire().
+        void close();
+
+    };
+
+} // namespace detector
@@ -2,45 +2,372 @@
 
 namespace detector {
 
-    int callback(void *notUsed, int argc, char **argv, char **azColName) {
-        return 0;
+    static constexpr const char *schema =
+            "CREATE TABLE IF NOT EXISTS track_points ("
+            "session    INTEGER NOT NULL,"
+            "source     INTEGER NOT NULL,"
+            "object_id  INTEGER NOT NULL,"
+            "class_id   INTEGER NOT NULL,"
+            "frame      INTEGER NOT NULL,"
+            "time_ms    INTEGER NOT NULL,"
+            "x          INTEGER NOT NULL,"
+            "y          INTEGER NOT NULL,"
+            "width      INTEGER NOT NULL,"
+            "height     INTEGER NOT NULL,"
+            "speed      REAL);"
+            "CREATE INDEX IF NOT EXISTS track_points_object ON track_points(session, source, object_id);"
+            "CREATE TABLE IF NOT EXISTS speed_events ("
+            "session       INTEGER NOT NULL,"
+            "source        INTEGER NOT NULL,"
+            "object_id     INTEGER NOT NULL,"
+            "class_id      INTEGER NOT NULL,"
+            "first_frame   INTEGER NOT NULL,"
+            "last_frame    INTEGER NOT NULL,"
+            "start_time_ms INTEGER NOT NULL,"
+            "end_time_ms   INTEGER NOT NULL,"
+            "mean_speed    REAL NOT NULL,"
+            "max_speed     REAL NOT NULL);";
+
+    static int64_t getTimeMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
     }
 
     DBException::DBException(string errMessage) : _errMessage(std::move(errMessage)) {}
 
-    const char *DBException::what() noexcept {
+    const char *DBException::what() const noexcept {
         return _errMessage.c_str();
     }
 
-    Storage::Storage(const string &dbFileName) {
-        int resCode = sqlite3_open(dbFileName.c_str(), &_db);
-        if (resCode) {
-            sqlite3_close(_db);
-            throw DBException(string(sqlite3_errmsg(_db)));
+    Storage::Storage(const string &dbFileName, const int64_t &session) : _session(session) {
+        auto resCode = sqlite3_open_v2(dbFileName.c_str(), &_db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, nullptr);
+        if (resCode != SQLITE_OK) {
+            string errMessage = _db ? sqlite3_errmsg(_db) : sqlite3_errstr(resCode);
+            close();
+            throw DBException(errMessage);
+        }
+        try {
+            // Readers of the database do not block commits, which only wait for the disk at checkpoints.
+            exec("PRAGMA journal_mode=WAL;");
+            exec("PRAGMA synchronous=NORMAL;");
+            check(sqlite3_busy_timeout(_db, 1000));
+            exec(schema);
+            _insertTrackPoint = prepare(
+                    "INSERT INTO track_points(session, source, object_id, class_id, frame, time_ms, "
+                    "x, y, width, height, speed) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
+            _insertSpeedEvent = prepare(
+                    "INSERT INTO speed_events(session, source, object_id, class_id, first_frame, last_frame, "
+                    "start_time_ms, end_time_ms, mean_speed, max_speed) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?);");
+        } catch (const DBException &) {
+            close();
+            throw;
         }
     }
 
     Storage::~Storage() {
+        close();
+    }
+
+    void Storage::close() {
+        sqlite3_finalize(_insertTrackPoint);
+        sqlite3_finalize(_insertSpeedEvent);
+        _insertTrackPoint = nullptr;
+        _insertSpeedEvent = nullptr;
         sqlite3_close(_db);
+        _db = nullptr;
+    }
+
+    void Storage::check(const int &resCode) const {
+        if (resCode != SQLITE_OK) {
+            throw DBException(sqlite3_errmsg(_db));
+        }
+    }
+
+    void Storage::exec(const char *sql) {
+        char *errMsg = nullptr;
+        auto resCode = sqlite3_exec(_db, sql, nullptr, nullptr, &errMsg);
+        if (resCode != SQLITE_OK) {
+            string errMessage = errMsg ? errMsg : sqlite3_errmsg(_db);
+            sqlite3_free(errMsg);
+            throw DBException(errMessage);
+        }
+    }
+
+    sqlite3_stmt *Storage::prepare(const char *sql) {
+        sqlite3_stmt *statement = nullptr;
+        check(sqlite3_prepare_v2(_db, sql, -1, &statement, nullptr));
+        return statement;
+    }
+
+    void Storage::insert(sqlite3_stmt *statement) {
+        auto resCode = sqlite3_step(statement);
+        if (resCode != SQLITE_DONE) {
+            string errMessage = sqlite3_errmsg(_db);
+            sqlite3_reset(statement);
+            throw DBException(errMessage);
+        }
+        sqlite3_reset(statement);
+    }
+
+    void Storage::begin() {
+        exec("BEGIN;");
+    }
+
+    void Storage::commit() {
+        exec("COMMIT;");
+    }
+
+    void Storage::rollback() {
+        // Failing statements may already have rolled the transaction back.
+        if (!sqlite3_get_autocommit(_db)) {
+            exec("ROLLBACK;");
+        }
+    }
+
+    void Storage::insertTrackPoint(const TrackEvent &event) {
+        auto statement = _insertTrackPoint;
+        sqlite3_bind_int64(statement, 1, _session);
+        sqlite3_bind_int64(statement, 2, event.source);
+        sqlite3_bind_int(statement, 3, event.objID);
+        sqlite3_bind_int(statement, 4, event.classId);
+        sqlite3_bind_int64(statement, 5, static_cast<sqlite3_int64>(event.frame));
+        sqlite3_bind_int64(statement, 6, event.timeMs);
+        sqlite3_bind_int(statement, 7, event.bbox.x);
+        sqlite3_bind_int(statement, 8, event.bbox.y);
+        sqlite3_bind_int(statement, 9, event.bbox.width);
+        sqlite3_bind_int(statement, 10, event.bbox.height);
+        if (event.speed < 0) {
+            sqlite3_bind_null(statement, 11);
+        } else {
+            sqlite3_bind_double(statement, 11, event.speed);
+        }
+        insert(statement);
+    }
+
+    void Storage::insertSpeedEvent(const SpeedEvent &event) {
+        auto statement = _insertSpeedEvent;
+        sqlite3_bind_int64(statement, 1, _session);
+        sqlite3_bind_int64(statement, 2, event.source);
+        sqlite3_bind_int(statement, 3, event.objID);
+        sqlite3_bind_int(statement, 4, event.classId);
+        sqlite3_bind_int64(statement, 5, static_cast<sqlite3_int64>(event.firstFrame));
+        sqlite3_bind_int64(statement, 6, static_cast<sqlite3_int64>(event.lastFrame));
+        sqlite3_bind_int64(statement, 7, event.startTimeMs);
+        sqlite3_bind_int64(statement, 8, event.endTimeMs);
+        sqlite3_bind_double(statement, 9, event.meanSpeed);
+        sqlite3_bind_double(statement, 10, event.maxSpeed);
+        insert(statement);
+    }
+
+    EventWriter::EventWriter(const string &dbFileName, const EventWriterOptions &options, Metrics *metrics) :
+            _options(options), _metrics(metrics), _storage(dbFileName, getTimeMs()) {
+        // Both buffers are swapped back and forth, so neither of them grows once running, unless track
+        // ends come in while the queue is full.
+        _pending.reserve(_options.queueCapacity);
+        _batch.reserve(_options.queueCapacity);
+        _thread = std::thread(&EventWriter::work, this);
+    }
+
+    EventWriter::~EventWriter() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopped = true;
+        }
+        _cond.notify_one();
+        _thread.join();
+        std::clog << "Event database: " << _written << " events written, " << _dropped << " dropped" << std::endl;
+    }
+
+    uint64_t EventWriter::getTrackKey(const uint32_t &source, const int &objID) {
+        return (uint64_t(source) << 32) | uint32_t(objID);
+    }
+
+    void EventWriter::record(const MultiTracker &multiTracker, const uint32_t &source, const uint64_t &frame) {
+        _frameEvents.clear();
+        auto timeMs = getTimeMs();
+        if (frame % _options.trackInterval == 0) {
+            multiTracker.forEachObject([&](const TrackedObjectView &obj) {
+                _frameEvents.push_back(TrackEvent{TrackEventType::POINT, source, frame, timeMs, obj.objID,
+                                                  obj.classId, obj.bbox, obj.speed});
+            });
+        }
+        for (auto objID: multiTracker.getRemovedObjects()) {
+            _frameEvents.push_back(TrackEvent{TrackEventType::END, source, frame, timeMs, objID, -1,
+                                              cv::Rect2i(), -1.});
+        }
+        push(_frameEvents);
+    }
+
+    void EventWriter::push(const vector<TrackEvent> &events) {
+        if (events.empty()) {
+            return;
+        }
+        bool batchReady;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_pending.size() + events.size() > _options.queueCapacity) {
+                // A lost track end would keep the summary of its track until the writer stops, so only
+                // the points are dropped.
+                uint64_t dropped = 0;
+                for (auto &event: events) {
+                    if (event.type == TrackEventType::END) {
+                        _pending.push_back(event);
+                    } else {
+                        dropped++;
+                    }
+                }
+                _dropped += dropped;
+                if (_metrics) {
+                    _metrics->addEventsDropped(dropped);
+                }
+            } else {
+                _pending.insert(_pending.end(), events.begin(), events.end());
+            }
+            batchReady = _pending.size() >= _options.batchRows;
+        }
+        if (batchReady) {
+            _cond.notify_one();
+        }
+    }
+
+    void EventWriter::work() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _cond.wait_for(lock, _options.flushInterval, [this] {
+                return _stopped || _pending.size() >= _options.batchRows;
+            });
+            std::swap(_pending, _batch);
+            auto stopped = _stopped;
+            lock.unlock();
+
+            write(_batch);
+            _batch.clear();
+            if (stopped) {
+                endAllTracks();
+                return;
+            }
+            lock.lock();
+        }
+    }
+
+    bool EventWriter::writeBatch(const vector<TrackEvent> &events, const size_t &first, const size_t &last) {
+        try {
+            _storage.begin();
+            for (auto i = first; i < last; i++) {
+                auto &event = events[i];
+                if (event.type == TrackEventType::POINT) {
+                    _storage.insertTrackPoint(event);
+                    addPoint(event);
+                } else {
+                    endTrack(getTrackKey(event.source, event.objID));
+                }
+            }
+            _storage.commit();
+        } catch (const DBException &e) {
+            std::cerr << "Cannot write track events: " << e.what() << std::endl;
+            try {
+                _storage.rollback();
+            } catch (const DBException &) {}
+            restoreTracks();
+            return false;
+        }
+        _changedTracks.clear();
+        return true;
+    }
+
+    void EventWriter::write(const vector<TrackEvent> &events) {
+        for (size_t first = 0; first < events.size(); first += _options.batchRows) {
+            auto last = std::min(events.size(), first + _options.batchRows);
+            // A transaction mostly fails on a busy or briefly unavailable database, so it is retried once.
+            if (writeBatch(events, first, last) || writeBatch(events, first, last)) {
+                _written += last - first;
+                if (_metrics) {
+                    _metrics->addEventsWritten(last - first);
+                }
+                continue;
+            }
+            // Tracks ended in the failed transaction get their speed events when the writer stops,
+            // without the points lost with it.
+            auto dropped = static_cast<uint64_t>(std::count_if(events.begin() + first, events.begin() + last,
+                                                               [](const TrackEvent &event) {
+                                                                   return event.type == TrackEventType::POINT;
+                                                               }));
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _dropped += dropped;
+            }
+            if (_metrics) {
+                _metrics->addEventsDropped(dropped);
+            }
+        }
+    }
+
+    void EventWriter::saveTrack(const uint64_t &key) {
+        if (_changedTracks.count(key)) {
+            return;
+        }
+        auto it = _tracks.find(key);
+        _changedTracks.emplace(key, it == _tracks.end() ? std::nullopt : std::make_optional(it->second));
+    }
+
+    void EventWriter::restoreTracks() {
+        for (auto &[key, summary]: _changedTracks) {
+            if (summary) {
+                _tracks[key] = *summary;
+            } else {
+                _tracks.erase(key);
+            }
+        }
+        _changedTracks.clear();
+    }
+
+    void EventWriter::addPoint(const TrackEvent &event) {
+        if (event.speed < 0) {
+            return;
+        }
+        auto key = getTrackKey(event.source, event.objID);
+        saveTrack(key);
+        auto it = _tracks.find(key);
+        if (it == _tracks.end()) {
+            _tracks.emplace(key, TrackSummary{event.classId, event.frame, event.frame, event.timeMs, event.timeMs,
+                                              1, event.speed, event.speed});
+            return;
+        }
+        auto &summary = it->second;
+        summary.lastFrame = event.frame;
+        summary.endTimeMs = event.timeMs;
+        summary.speedCount++;
+        summary.speedSum += event.speed;
+        summary.maxSpeed = std::max(summary.maxSpeed, event.speed);
     }
 
-    void Storage::createSchema() {
-        string sql = "CREATE TABLE actions ("  \
-                         "id         INT PRIMARY KEY NOT NULL," \
-                         "video_path TEXT NOT NULL," \
-                         "type       TEXT NOT NULL);";
-        int resCode = sqlite3_exec(_db, sql.c_str(), callback, nullptr, &_errMsg);
-        if (resCode) {
-            throw DBException(string(_errMsg));
+    void EventWriter::endTrack(const uint64_t &key) {
+        auto it = _tracks.find(key);
+        if (it == _tracks.end()) {
+            return;
         }
+        saveTrack(key);
+        auto &summary = it->second;
+        auto event = SpeedEvent{uint32_t(key >> 32), int(uint32_t(key)), summary.classId,
+                                summary.firstFrame, summary.lastFrame, summary.startTimeMs, summary.endTimeMs,
+                                summary.speedSum / summary.speedCount, summary.maxSpeed};
+        _tracks.erase(it);
+        _storage.insertSpeedEvent(event);
     }
 
-    void Storage::insert(const Action &action) {
-        string sql = "INSERT INTO actions(id, video_path, type)" \
-                         "VALUES (" + std::to_string(action.id) + "," + action.videoPath + "," + action.type + ")";
-        int resCode = sqlite3_exec(_db, sql.c_str(), callback, nullptr, &_errMsg);
-        if (resCode) {
-            throw DBException(string(_errMsg));
+    void EventWriter::endAllTracks() {
+        try {
+            _storage.begin();
+            while (!_tracks.empty()) {
+                endTrack(_tracks.begin()->first);
+            }
+            _storage.commit();
+            _changedTracks.clear();
+        } catch (const DBException &e) {
+            std::cerr << "Cannot write speed events: " << e.what() << std::endl;
+            try {
+                _storage.rollback();
+            } catch (const DBException &) {}
         }
     }
 
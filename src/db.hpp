@@ -1,19 +1,49 @@
+#pragma once
+
 #include <sqlite3.h>
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
 #include <utility>
 
 #include "multitracker.hpp"
 
 namespace detector {
 
+    enum class TrackEventType : int {
+        POINT = 0,
+        END
+    };
 
-    struct Action {
-        int id;
-        string videoPath;
-        string type;
+    // Box and speed of an object in one frame, or the end of its track. Plain data, so that queueing
+    // an event is a copy. Speeds are in km/h, -1 outside of measurement zones.
+    struct TrackEvent {
+        TrackEventType type;
+        uint32_t source;
+        uint64_t frame;
+        int64_t timeMs;
+        int objID;
+        int classId;
+        cv::Rect2i bbox;
+        double speed;
     };
 
-    int callback(void *notUsed, int argc, char **argv, char **azColName);
+    // Speeds of an object over the frames its speed was measured in, written once its track ended.
+    struct SpeedEvent {
+        uint32_t source;
+        int objID;
+        int classId;
+        uint64_t firstFrame;
+        uint64_t lastFrame;
+        int64_t startTimeMs;
+        int64_t endTimeMs;
+        double meanSpeed;
+        double maxSpeed;
+    };
 
     class DBException : public std::exception {
     private:
@@ -24,25 +54,144 @@ namespace detector {
 
         explicit DBException(string errMessage);
 
-        virtual const char *what() noexcept;
+        [[nodiscard]] const char *what() const noexcept override;
 
     };
 
+    // SQLite database of tracks: a track_points row per object and recorded frame, a speed_events row
+    // per object whose speed was measured. Object IDs restart with every run of the application, rows
+    // of one run share its session, the time it started at in ms since the epoch.
+    // Inserts go through prepared statements and are only durable once the enclosing transaction is
+    // committed. Errors are thrown as DBException.
     class Storage {
-    public:
+    private:
+
+        sqlite3 *_db = nullptr;
+        sqlite3_stmt *_insertTrackPoint = nullptr;
+        sqlite3_stmt *_insertSpeedEvent = nullptr;
+        int64_t _session;
 
-        sqlite3 *_db;
-        char *_errMsg;
+        void check(const int &resCode) const;
+
+        void exec(const char *sql);
+
+        sqlite3_stmt *prepare(const char *sql);
+
+        void insert(sqlite3_stmt *statement);
+
+        void close();
 
     public:
 
-        explicit Storage(const string &dbFileName);
+        Storage(const string &dbFileName, const int64_t &session);
 
         ~Storage();
 
-        void createSchema();
+        Storage(const Storage &) = delete;
+
+        Storage &operator=(const Storage &) = delete;
+
+        void begin();
+
+        void commit();
+
+        void rollback();
+
+        void insertTrackPoint(const TrackEvent &event);
+
+        void insertSpeedEvent(const SpeedEvent &event);
+
+    };
+
+    struct EventWriterOptions {
+        // A transaction is committed every batchRows events, or every flushInterval when fewer came in.
+        size_t batchRows = 500;
+        std::chrono::milliseconds flushInterval{1000};
+        // Events waiting for the writer; beyond that new track points are dropped rather than waited
+        // for. Track ends are always queued.
+        size_t queueCapacity = 10000;
+        // Track points are recorded every trackInterval frames, track ends always.
+        uint64_t trackInterval = 1;
+    };
+
+    // Records tracks into a Storage on a thread of its own, so that the frame loop only ever copies
+    // events into a bounded queue under a short lock. A stalling disk fills the queue and costs track
+    // points, counted as dropped, but never frames nor track ends. A batch failing twice costs its points
+    // the same way. Speed events are aggregated on the writer thread.
+    class EventWriter {
+    private:
+
+        struct TrackSummary {
+            int classId;
+            uint64_t firstFrame;
+            uint64_t lastFrame;
+            int64_t startTimeMs;
+            int64_t endTimeMs;
+            uint64_t speedCount;
+            double speedSum;
+            double maxSpeed;
+        };
+
+        EventWriterOptions _options;
+        Metrics *_metrics;
+        Storage _storage;
+
+        // Only touched by the thread calling record().
+        vector<TrackEvent> _frameEvents;
+
+        // Queue filled by push() and swapped with _batch by the writer thread.
+        vector<TrackEvent> _pending;
+        uint64_t _dropped = 0;
+        bool _stopped = false;
+        std::mutex _mutex;
+        std::condition_variable _cond;
+
+        // Writer thread state.
+        vector<TrackEvent> _batch;
+        std::unordered_map<uint64_t, TrackSummary> _tracks;
+        // Summaries as they were before the open transaction changed them, put back if it fails.
+        std::unordered_map<uint64_t, std::optional<TrackSummary>> _changedTracks;
+        uint64_t _written = 0;
+        std::thread _thread;
+
+        static uint64_t getTrackKey(const uint32_t &source, const int &objID);
+
+        void work();
+
+        // Writes events [first, last) in one transaction. On failure it is rolled back along with the
+        // track summaries it changed.
+        bool writeBatch(const vector<TrackEvent> &events, const size_t &first, const size_t &last);
+
+        void write(const vector<TrackEvent> &events);
+
+        void saveTrack(const uint64_t &key);
+
+        void restoreTracks();
+
+        void addPoint(const TrackEvent &event);
+
+        void endTrack(const uint64_t &key);
+
+        void endAllTracks();
+
+    public:
+
+        EventWriter(const string &dbFileName, const EventWriterOptions &options, Metrics *metrics);
+
+        // Writes what is still queued and ends the tracks of objects alive at that point.
+        ~EventWriter();
+
+        EventWriter(const EventWriter &) = delete;
+
+        EventWriter &operator=(const EventWriter &) = delete;
+
+        // Queues the objects of the frame last tracked by multiTracker and the ends of the tracks it
+        // removed. Must be called from one thread, after updateSpeeds().
+        void record(const MultiTracker &multiTracker, const uint32_t &source, const uint64_t &frame);
 
-        void insert(const Action &action);
+        // Queues events as a whole, or only the track ends among them when the queue is full. Never
+        // waits for the writer.
+        void push(const vector<TrackEvent> &events);
 
     };
 
@@ -0,0 +1,141 @@
+#include "detector_worker.hpp"
+
+namespace detector {
+
+    // The network only sees the ROI of a job, so its tile band is moved into the ROI's rows.
+    static cv::Range getRoiTileBand(const DetectionJob &job) {
+        if (job.roi.empty() || job.tileBand == cv::Range::all()) {
+            return job.tileBand;
+        }
+        return (job.tileBand & cv::Range(job.roi.y, job.roi.y + job.roi.height)) - job.roi.y;
+    }
+
+    DetectorWorker::DetectorWorker(MobileNetSSD &net, const set<int> &classesSet, const float &confCoefficient) :
+            _net(net), _classMask(makeClassMask(classesSet)), _confCoefficient(confCoefficient) {
+        _thread = std::thread(&DetectorWorker::work, this);
+    }
+
+    DetectorWorker::~DetectorWorker() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopped = true;
+        }
+        _jobCond.notify_all();
+        _thread.join();
+    }
+
+    void DetectorWorker::work() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _jobCond.wait(lock, [this] { return _stopped || (_busy && !_ready); });
+            if (_stopped) {
+                return;
+            }
+            // Jobs are owned by this thread until _ready is set, so the network runs unlocked.
+            lock.unlock();
+            {
+                ScopedStageTimer detectTimer(_metrics, Stage::DETECT);
+                if (_jobs.size() == 1) {
+                    auto &job = _jobs.front();
+                    _net.detectObjects(job.roi.empty() ? job.frame : job.frame(job.roi), _classMask,
+                                       _confCoefficient, job.detectedObjects, getRoiTileBand(job));
+                } else {
+                    _frames.clear();
+                    _tileBands.clear();
+                    for (auto &job: _jobs) {
+                        _frames.push_back(job.roi.empty() ? job.frame : job.frame(job.roi));
+                        _tileBands.push_back(getRoiTileBand(job));
+                    }
+                    _net.detectObjects(_frames, _classMask, _confCoefficient, _detections, _tileBands);
+                    // Swapping keeps the vectors' capacity circulating between the jobs and this worker.
+                    for (size_t i = 0; i < _jobs.size(); i++) {
+                        std::swap(_jobs[i].detectedObjects, _detections[i]);
+                    }
+                }
+                for (auto &job: _jobs) {
+                    for (auto &obj: job.detectedObjects) {
+                        obj.bbox.x += job.roi.x;
+                        obj.bbox.y += job.roi.y;
+                    }
+                }
+            }
+            if (_metrics) {
+                for (auto &job: _jobs) {
+                    for (auto &obj: job.detectedObjects) {
+                        _metrics->addDetection(obj.classId);
+                    }
+                }
+            }
+            lock.lock();
+            _ready = true;
+        }
+    }
+
+    void DetectorWorker::setMetrics(Metrics *metrics) {
+        _metrics = metrics;
+    }
+
+    bool DetectorWorker::isIdle() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return !_busy;
+    }
+
+    bool DetectorWorker::trySubmit(const uint64_t &seq, const cv::Mat &frame, const ObjectBboxes &trackedBboxes,
+                                   const cv::Rect2i &roi, const cv::Range &tileBand) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_busy) {
+                return false;
+            }
+            _jobs.resize(1);
+            auto &job = _jobs.front();
+            job.stream = 0;
+            job.seq = seq;
+            // The caller keeps drawing on and reusing its frame, the detector needs its own snapshot.
+            frame.copyTo(job.frame);
+            job.roi = roi;
+            job.tileBand = tileBand;
+            job.trackedBboxes.assign(trackedBboxes.begin(), trackedBboxes.end());
+            job.detectedObjects.clear();
+            _busy = true;
+        }
+        _jobCond.notify_one();
+        return true;
+    }
+
+    bool DetectorWorker::poll(DetectionJob &job) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_ready) {
+            return false;
+        }
+        std::swap(job, _jobs.front());
+        _busy = false;
+        _ready = false;
+        return true;
+    }
+
+    bool DetectorWorker::trySubmit(vector<DetectionJob> &jobs) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_busy || jobs.empty()) {
+                return false;
+            }
+            std::swap(_jobs, jobs);
+            _busy = true;
+        }
+        _jobCond.notify_one();
+        return true;
+    }
+
+    bool DetectorWorker::poll(vector<DetectionJob> &jobs) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_ready) {
+            return false;
+        }
+        std::swap(jobs, _jobs);
+        _busy = false;
+        _ready = false;
+        return true;
+    }
+
+} // namespace detector
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "metrics.hpp"
+#include "object_store.hpp"
+
+namespace detector {
+
+    struct DetectionJob {
+        size_t stream{};
+        uint64_t seq{};
+        cv::Mat frame;
+        // Part of the frame the detector runs on, the whole frame when empty. Detected boxes are
+        // in frame coordinates either way.
+        cv::Rect2i roi;
+        // Frame rows detection tiles are restricted to.
+        cv::Range tileBand = cv::Range::all();
+        ObjectBboxes trackedBboxes;
+        vector<DetectionResult> detectedObjects;
+    };
+
+    // Runs MobileNetSSD on its own thread so the tracking loop never waits for a forward pass.
+    // At most one job is in flight: trySubmit() refuses new frames while the network is busy,
+    // which makes the detection cadence follow the detector throughput instead of a fixed period.
+    // A job may carry frames of several video streams, they go through the network as one batch.
+    class DetectorWorker {
+    private:
+
+        MobileNetSSD &_net;
+        ClassMask _classMask;
+        float _confCoefficient;
+        Metrics *_metrics = nullptr;
+
+        vector<DetectionJob> _jobs;
+        vector<cv::Mat> _frames;
+        vector<cv::Range> _tileBands;
+        vector<vector<DetectionResult>> _detections;
+        bool _busy = false;
+        bool _ready = false;
+        bool _stopped = false;
+
+        std::mutex _mutex;
+        std::condition_variable _jobCond;
+        std::thread _thread;
+
+        void work();
+
+    public:
+
+        DetectorWorker(MobileNetSSD &net, const set<int> &classesSet, const float &confCoefficient);
+
+        ~DetectorWorker();
+
+        DetectorWorker(const DetectorWorker &) = delete;
+
+        DetectorWorker &operator=(const DetectorWorker &) = delete;
+
+        // Must be attached before the first job is submitted.
+        void setMetrics(Metrics *metrics);
+
+        // Whether trySubmit() would accept a job now. Only meaningful on the thread submitting jobs.
+        [[nodiscard]] bool isIdle();
+
+        bool trySubmit(const uint64_t &seq, const cv::Mat &frame, const ObjectBboxes &trackedBboxes,
+                       const cv::Rect2i &roi = cv::Rect2i(), const cv::Range &tileBand = cv::Range::all());
+
+        bool poll(DetectionJob &job);
+
+        // Takes over the jobs (their frames must not be reused by the caller) and leaves the buffers
+        // of the previous batch in their place.
+        bool trySubmit(vector<DetectionJob> &jobs);
+
+        bool poll(vector<DetectionJob> &jobs);
+
+    };
+
+} // namespace detector
@@ -0,0 +1,46 @@
+#include "frame_arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+namespace detector {
+
+    void *FrameArena::do_allocate(size_t bytes, size_t alignment) {
+        while (_chunk < _chunks.size()) {
+            auto &chunk = _chunks[_chunk];
+            auto base = reinterpret_cast<uintptr_t>(chunk.data.get());
+            auto aligned = (base + _offset + alignment - 1) / alignment * alignment;
+            if (aligned + bytes <= base + chunk.size) {
+                _offset = aligned + bytes - base;
+                return reinterpret_cast<void *>(aligned);
+            }
+            _chunk++;
+            _offset = 0;
+        }
+        auto size = std::max({_minChunkSize, bytes + alignment, _chunks.empty() ? 0 : 2 * _chunks.back().size});
+        _chunks.push_back(Chunk{std::make_unique<std::byte[]>(size), size});
+        _chunk = _chunks.size() - 1;
+        _offset = 0;
+        return do_allocate(bytes, alignment);
+    }
+
+    void FrameArena::reset() {
+        // A frame that spilled over several chunks is served by a single one from now on.
+        if (_chunks.size() > 1) {
+            auto size = capacity();
+            _chunks.clear();
+            _chunks.push_back(Chunk{std::make_unique<std::byte[]>(size), size});
+        }
+        _chunk = 0;
+        _offset = 0;
+    }
+
+    size_t FrameArena::capacity() const {
+        size_t size = 0;
+        for (auto &chunk: _chunks) {
+            size += chunk.size;
+        }
+        return size;
+    }
+
+} // namespace detector
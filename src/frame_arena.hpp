@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+namespace detector {
+
+    // Bump allocator for scratch memory that lives no longer than one frame. Deallocation is a no-op;
+    // reset() makes the whole arena reusable at once. Memory is never given back: once the arena has
+    // grown to the peak need of a frame, later frames are served without touching the heap.
+    class FrameArena : public std::pmr::memory_resource {
+    private:
+
+        struct Chunk {
+            std::unique_ptr<std::byte[]> data;
+            size_t size;
+        };
+
+        static constexpr size_t _minChunkSize = 64 * 1024;
+
+        std::vector<Chunk> _chunks;
+        size_t _chunk = 0;
+        size_t _offset = 0;
+
+        void *do_allocate(size_t bytes, size_t alignment) override;
+
+        void do_deallocate(void *, size_t, size_t) override {}
+
+        [[nodiscard]] bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override {
+            return this == &other;
+        }
+
+    public:
+
+        FrameArena() = default;
+
+        FrameArena(const FrameArena &) = delete;
+
+        FrameArena &operator=(const FrameArena &) = delete;
+
+        // Everything allocated before is invalidated.
+        void reset();
+
+        [[nodiscard]] size_t capacity() const;
+
+    };
+
+} // namespace detector
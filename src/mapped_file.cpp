@@ -0,0 +1,41 @@
+#include "mapped_file.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <stdexcept>
+
+namespace detector {
+
+    MappedFile::MappedFile(const std::string &fileName) {
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + fileName);
+        }
+        struct stat fileStat{};
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+            close(fd);
+            throw std::runtime_error("cannot read " + fileName);
+        }
+        _size = static_cast<size_t>(fileStat.st_size);
+        _data = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping keeps its own reference to the file.
+        close(fd);
+        if (_data == MAP_FAILED) {
+            _data = nullptr;
+            throw std::runtime_error("cannot map " + fileName);
+        }
+        // The file is parsed once from start to end, so it is read ahead aggressively from the start.
+        madvise(_data, _size, MADV_SEQUENTIAL);
+        madvise(_data, _size, MADV_WILLNEED);
+    }
+
+    MappedFile::~MappedFile() {
+        if (_data) {
+            munmap(_data, _size);
+        }
+    }
+
+} // namespace detector
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace detector {
+
+    // Read-only memory mapping of a whole file. Pages are read by the kernel as they are touched, straight
+    // from the page cache, instead of being copied through a stream buffer into a string first.
+    // Throws std::runtime_error when the file cannot be mapped.
+    class MappedFile {
+    private:
+
+        void *_data = nullptr;
+        size_t _size = 0;
+
+    public:
+
+        explicit MappedFile(const std::string &fileName);
+
+        ~MappedFile();
+
+        MappedFile(const MappedFile &) = delete;
+
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        [[nodiscard]] const char *data() const { return static_cast<const char *>(_data); }
+
+        [[nodiscard]] size_t size() const { return _size; }
+
+    };
+
+} // namespace detector
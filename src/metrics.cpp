@@ -0,0 +1,222 @@
+#include "metrics.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+namespace detector {
+
+    const char *getStageName(const Stage &stage) {
+        switch (stage) {
+            case Stage::DECODE:
+                return "decode";
+            case Stage::TRACK:
+                return "track";
+            case Stage::DETECT:
+                return "detect";
+            case Stage::ASSOCIATE:
+                return "associate";
+            case Stage::SPEED:
+                return "speed";
+            case Stage::OVERLAY:
+                return "overlay";
+            case Stage::ENCODE:
+                return "encode";
+            default:
+                return "unknown";
+        }
+    }
+
+    void LatencyHistogram::observe(const double &durationMs) {
+        auto seconds = durationMs / 1000.;
+        size_t bucket = 0;
+        while (bucket < _bounds.size() && seconds > _bounds[bucket]) {
+            bucket++;
+        }
+        _buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        _sumNs.fetch_add(static_cast<uint64_t>(std::max(durationMs, 0.) * 1e6), std::memory_order_relaxed);
+        _count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void LatencyHistogram::write(std::ostream &out, const std::string &name, const std::string &labels) const {
+        uint64_t cumulative = 0;
+        for (size_t bucket = 0; bucket <= _bounds.size(); bucket++) {
+            cumulative += _buckets[bucket].load(std::memory_order_relaxed);
+            out << name << "_bucket{" << labels << "le=\"";
+            if (bucket < _bounds.size()) {
+                out << _bounds[bucket];
+            } else {
+                out << "+Inf";
+            }
+            out << "\"} " << cumulative << "\n";
+        }
+        auto bareLabels = labels.empty() ? "" : "{" + labels.substr(0, labels.size() - 1) + "}";
+        out << name << "_sum" << bareLabels << " " << double(_sumNs.load(std::memory_order_relaxed)) / 1e9 << "\n";
+        out << name << "_count" << bareLabels << " " << cumulative << "\n";
+    }
+
+    void Metrics::setKeepSamples(const bool &keepSamples) {
+        _keepSamples = keepSamples;
+    }
+
+    void Metrics::addStageDuration(const Stage &stage, const double &durationMs) {
+        _stageDurations[static_cast<size_t>(stage)].observe(durationMs);
+        if (_keepSamples.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(_samplesMutex);
+            _samples[static_cast<size_t>(stage)].push_back(durationMs);
+        }
+    }
+
+    void Metrics::addFrame(const double &latencyMs) {
+        _frameLatency.observe(latencyMs);
+    }
+
+    void Metrics::addDroppedFrames(const uint64_t &count) {
+        _framesDropped.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void Metrics::addTrackersCreated(const uint64_t &count) {
+        _trackersCreated.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void Metrics::addTrackersRemoved(const uint64_t &count) {
+        _trackersRemoved.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void Metrics::addDetection(const int &classId) {
+        if (classId >= 0 && classId < static_cast<int>(nClasses)) {
+            _detections[classId].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void Metrics::addMotionGateCheck(const bool &skipped, const uint64_t &pixels, const uint64_t &skippedPixels) {
+        _motionGateChecks.fetch_add(1, std::memory_order_relaxed);
+        _motionGateSkipped.fetch_add(skipped, std::memory_order_relaxed);
+        _motionGatePixels.fetch_add(pixels, std::memory_order_relaxed);
+        _motionGateSkippedPixels.fetch_add(skippedPixels, std::memory_order_relaxed);
+    }
+
+    void Metrics::addEventsWritten(const uint64_t &count) {
+        _eventsWritten.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void Metrics::addEventsDropped(const uint64_t &count) {
+        _eventsDropped.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void Metrics::setObjectCounts(const uint64_t &live, const uint64_t &retired, const uint64_t &slots) {
+        _objectsLive.store(live, std::memory_order_relaxed);
+        _objectsRetired.store(retired, std::memory_order_relaxed);
+        _objectSlots.store(slots, std::memory_order_relaxed);
+    }
+
+    std::vector<double> Metrics::getSamples(const Stage &stage) const {
+        std::lock_guard<std::mutex> lock(_samplesMutex);
+        return _samples[static_cast<size_t>(stage)];
+    }
+
+    void Metrics::writePrometheus(std::ostream &out) const {
+        auto writeCounter = [&](const char *name, const char *help, const std::atomic<uint64_t> &value) {
+            out << "# HELP " << name << " " << help << "\n";
+            out << "# TYPE " << name << " counter\n";
+            out << name << " " << value.load(std::memory_order_relaxed) << "\n";
+        };
+        auto writeGauge = [&](const char *name, const char *help, const std::atomic<uint64_t> &value) {
+            out << "# HELP " << name << " " << help << "\n";
+            out << "# TYPE " << name << " gauge\n";
+            out << name << " " << value.load(std::memory_order_relaxed) << "\n";
+        };
+
+        out << "# HELP video_tracker_frame_latency_seconds Time from capture until a frame is processed\n";
+        out << "# TYPE video_tracker_frame_latency_seconds histogram\n";
+        _frameLatency.write(out, "video_tracker_frame_latency_seconds", "");
+        out << "# HELP video_tracker_frames_total Processed frames\n";
+        out << "# TYPE video_tracker_frames_total counter\n";
+        out << "video_tracker_frames_total " << _frameLatency.count() << "\n";
+        writeCounter("video_tracker_frames_dropped_total", "Frames dropped by pipeline backpressure", _framesDropped);
+        writeCounter("video_tracker_trackers_created_total", "Object trackers started", _trackersCreated);
+        writeCounter("video_tracker_trackers_removed_total", "Object trackers removed", _trackersRemoved);
+        writeGauge("video_tracker_objects_live", "Objects currently tracked", _objectsLive);
+        writeCounter("video_tracker_objects_retired_total", "Tracked objects retired", _objectsRetired);
+        writeGauge("video_tracker_object_slots", "Allocated slots of the tracked object tables", _objectSlots);
+        writeCounter("video_tracker_motion_gate_checks_total", "Frames checked for motion before detection",
+                     _motionGateChecks);
+        writeCounter("video_tracker_motion_gate_skipped_total", "Detections skipped for lack of motion",
+                     _motionGateSkipped);
+        writeCounter("video_tracker_motion_gate_pixels_total", "Pixels checked for motion before detection",
+                     _motionGatePixels);
+        writeCounter("video_tracker_motion_gate_skipped_pixels_total", "Checked pixels the detector did not run on",
+                     _motionGateSkippedPixels);
+        writeCounter("video_tracker_events_written_total", "Track events written to the database", _eventsWritten);
+        writeCounter("video_tracker_events_dropped_total",
+                     "Track events dropped on a full database queue or a failed write", _eventsDropped);
+
+        out << "# HELP video_tracker_stage_duration_seconds Duration of frame processing stages\n";
+        out << "# TYPE video_tracker_stage_duration_seconds histogram\n";
+        for (int stage = 0; stage < static_cast<int>(Stage::COUNT); stage++) {
+            _stageDurations[stage].write(out, "video_tracker_stage_duration_seconds",
+                                         std::string("stage=\"") + getStageName(Stage(stage)) + "\",");
+        }
+
+        out << "# HELP video_tracker_detections_total Detections reported by the model, per class\n";
+        out << "# TYPE video_tracker_detections_total counter\n";
+        for (size_t classId = 0; classId < nClasses; classId++) {
+            out << "video_tracker_detections_total{class=\"" << getClassName(static_cast<int>(classId)) << "\"} "
+                << _detections[classId].load(std::memory_order_relaxed) << "\n";
+        }
+    }
+
+    void Metrics::dumpToFile(const std::string &fileName) const {
+        auto tmpFileName = fileName + ".tmp";
+        {
+            std::ofstream file(tmpFileName);
+            if (!file.is_open()) {
+                std::cerr << "Cannot open metrics file: " << tmpFileName << std::endl;
+                return;
+            }
+            writePrometheus(file);
+        }
+        if (std::rename(tmpFileName.c_str(), fileName.c_str()) != 0) {
+            std::cerr << "Cannot replace metrics file: " << fileName << std::endl;
+        }
+    }
+
+    ScopedStageTimer::ScopedStageTimer(Metrics *metrics, const Stage &stage) :
+            _metrics(metrics), _stage(stage) {
+        if (_metrics) {
+            _startTime = std::chrono::steady_clock::now();
+        }
+    }
+
+    ScopedStageTimer::~ScopedStageTimer() {
+        if (_metrics) {
+            auto elapsed = std::chrono::steady_clock::now() - _startTime;
+            _metrics->addStageDuration(_stage, std::chrono::duration<double, std::milli>(elapsed).count());
+        }
+    }
+
+    MetricsDumper::MetricsDumper(const Metrics &metrics, std::string fileName, const std::chrono::seconds &interval) :
+            _metrics(metrics), _fileName(std::move(fileName)), _interval(interval) {
+        _thread = std::thread(&MetricsDumper::work, this);
+    }
+
+    MetricsDumper::~MetricsDumper() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopped = true;
+        }
+        _stopCond.notify_one();
+        _thread.join();
+        _metrics.dumpToFile(_fileName);
+    }
+
+    void MetricsDumper::work() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_stopCond.wait_for(lock, _interval, [this] { return _stopped; })) {
+            lock.unlock();
+            _metrics.dumpToFile(_fileName);
+            lock.lock();
+        }
+    }
+
+} // namespace detector
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "model.hpp"
+
+namespace detector {
+
+    enum class Stage : int {
+        DECODE = 0,
+        TRACK,
+        DETECT,
+        ASSOCIATE,
+        SPEED,
+        OVERLAY,
+        ENCODE,
+        COUNT
+    };
+
+    const char *getStageName(const Stage &stage);
+
+    // Fixed-bucket latency histogram. Recording is a couple of relaxed atomic increments, so it can be
+    // done from any thread on every frame; readers get a consistent enough snapshot for monitoring.
+    class LatencyHistogram {
+    private:
+
+        // Upper bounds of the buckets in seconds, the last bucket (+Inf) is implicit.
+        static constexpr std::array<double, 14> _bounds{
+                0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1., 2.5
+        };
+
+        std::array<std::atomic<uint64_t>, _bounds.size() + 1> _buckets{};
+        std::atomic<uint64_t> _count{0};
+        std::atomic<uint64_t> _sumNs{0};
+
+    public:
+
+        void observe(const double &durationMs);
+
+        [[nodiscard]] uint64_t count() const { return _count.load(std::memory_order_relaxed); }
+
+        // Writes the histogram in Prometheus text format; labels are either empty or "name=\"value\",".
+        void write(std::ostream &out, const std::string &name, const std::string &labels) const;
+
+    };
+
+    // Telemetry of the frame processing: stage duration and frame latency histograms plus event counters.
+    // Stages run on different threads (detection has its own) and everything here is lock-free, except
+    // for raw samples which are only kept on request, for benchmarks needing exact percentiles.
+    // Components hold a nullable pointer to it: without metrics attached nothing is measured.
+    class Metrics {
+    private:
+
+        std::array<LatencyHistogram, static_cast<size_t>(Stage::COUNT)> _stageDurations;
+        LatencyHistogram _frameLatency;
+
+        std::atomic<uint64_t> _framesDropped{0};
+        std::atomic<uint64_t> _trackersCreated{0};
+        std::atomic<uint64_t> _trackersRemoved{0};
+        std::array<std::atomic<uint64_t>, nClasses> _detections{};
+        std::atomic<uint64_t> _motionGateChecks{0};
+        std::atomic<uint64_t> _motionGateSkipped{0};
+        std::atomic<uint64_t> _motionGatePixels{0};
+        std::atomic<uint64_t> _motionGateSkippedPixels{0};
+        std::atomic<uint64_t> _eventsWritten{0};
+        std::atomic<uint64_t> _eventsDropped{0};
+        std::atomic<uint64_t> _objectsLive{0};
+        std::atomic<uint64_t> _objectsRetired{0};
+        std::atomic<uint64_t> _objectSlots{0};
+
+        std::atomic<bool> _keepSamples{false};
+        std::array<std::vector<double>, static_cast<size_t>(Stage::COUNT)> _samples;
+        mutable std::mutex _samplesMutex;
+
+    public:
+
+        void setKeepSamples(const bool &keepSamples);
+
+        void addStageDuration(const Stage &stage, const double &durationMs);
+
+        void addFrame(const double &latencyMs);
+
+        void addDroppedFrames(const uint64_t &count);
+
+        void addTrackersCreated(const uint64_t &count);
+
+        void addTrackersRemoved(const uint64_t &count);
+
+        void addDetection(const int &classId);
+
+        void addMotionGateCheck(const bool &skipped, const uint64_t &pixels, const uint64_t &skippedPixels);
+
+        void addEventsWritten(const uint64_t &count);
+
+        void addEventsDropped(const uint64_t &count);
+
+        // Tracked objects summed over all video sources: live ones, retired since the start and slots
+        // of the object tables, which stay flat once the busiest scene has been seen.
+        void setObjectCounts(const uint64_t &live, const uint64_t &retired, const uint64_t &slots);
+
+        [[nodiscard]] std::vector<double> getSamples(const Stage &stage) const;
+
+        void writePrometheus(std::ostream &out) const;
+
+        // Replaces fileName atomically, so a scraper never reads a half-written file.
+        void dumpToFile(const std::string &fileName) const;
+
+    };
+
+    class ScopedStageTimer {
+    private:
+
+        Metrics *_metrics;
+        Stage _stage;
+        std::chrono::steady_clock::time_point _startTime;
+
+    public:
+
+        ScopedStageTimer(Metrics *metrics, const Stage &stage);
+
+        ~ScopedStageTimer();
+
+        ScopedStageTimer(const ScopedStageTimer &) = delete;
+
+        ScopedStageTimer &operator=(const ScopedStageTimer &) = delete;
+
+    };
+
+    // Periodically dumps metrics into a Prometheus text file (e.g. for node_exporter's textfile
+    // collector) from a background thread. The last dump is written when it is destroyed.
+    class MetricsDumper {
+    private:
+
+        const Metrics &_metrics;
+        std::string _fileName;
+        std::chrono::seconds _interval;
+
+        bool _stopped = false;
+        std::mutex _mutex;
+        std::condition_variable _stopCond;
+        std::thread _thread;
+
+        void work();
+
+    public:
+
+        MetricsDumper(const Metrics &metrics, std::string fileName, const std::chrono::seconds &interval);
+
+        ~MetricsDumper();
+
+        MetricsDumper(const MetricsDumper &) = delete;
+
+        MetricsDumper &operator=(const MetricsDumper &) = delete;
+
+    };
+
+} // namespace detector
@@ -1,9 +1,20 @@
 #include "model.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
 #include <utility>
 
+#include "association.hpp"
+#include "mapped_file.hpp"
+
 namespace detector {
 
+    // Two detections of one class overlapping more than this are the same object.
+    static constexpr double nmsThreshold = 0.45;
+    // Pixels from a tile border within which a box is considered cut by it.
+    static constexpr int tileCutMargin = 2;
+
     unordered_map<ObjectClass, string> class2name{
             {ObjectClass::BACKGROUND,   "Background"},
             {ObjectClass::AEROPLANE,    "Aeroplane"},
@@ -28,54 +39,407 @@ namespace detector {
             {ObjectClass::TV_MONITOR,   "TV Monitor"}
     };
 
+    string getClassName(const int &classId) {
+        auto it = class2name.find(static_cast<ObjectClass>(classId));
+        return it != class2name.end() ? it->second : "Unknown";
+    }
+
+    bool parseInferenceBackend(const string &name, InferenceBackend &backend) {
+        if (name == "opencv") {
+            backend = InferenceBackend::OPENCV;
+        } else if (name == "openvino") {
+            backend = InferenceBackend::OPENVINO;
+        } else if (name == "cuda") {
+            backend = InferenceBackend::CUDA;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    bool parseInferencePrecision(const string &name, InferencePrecision &precision) {
+        if (name == "fp32") {
+            precision = InferencePrecision::FP32;
+        } else if (name == "fp16") {
+            precision = InferencePrecision::FP16;
+        } else if (name == "int8") {
+            precision = InferencePrecision::INT8;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    bool isInferenceSupported(const InferenceOptions &options) {
+        switch (options.backend) {
+            case InferenceBackend::OPENVINO:
+                // The CPU plugin computes in FP32 whatever the IR is stored in.
+                return options.precision != InferencePrecision::FP16;
+            case InferenceBackend::CUDA:
+                return options.precision != InferencePrecision::INT8;
+            default:
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 9)
+                return true;
+#else
+                // FP16 on CPU came with OpenCV 4.9.
+                return options.precision != InferencePrecision::FP16;
+#endif
+        }
+    }
+
+    static cv::dnn::Backend getDnnBackend(const InferenceOptions &options) {
+        switch (options.backend) {
+            case InferenceBackend::OPENVINO:
+                // DNN_BACKEND_INFERENCE_ENGINE is only an alias that OpenCV resolves to the nGraph API,
+                // the one getAvailableBackends() lists.
+                return cv::dnn::DNN_BACKEND_INFERENCE_ENGINE_NGRAPH;
+            case InferenceBackend::CUDA:
+                return cv::dnn::DNN_BACKEND_CUDA;
+            default:
+                return cv::dnn::DNN_BACKEND_OPENCV;
+        }
+    }
+
+    static cv::dnn::Target getDnnTarget(const InferenceOptions &options) {
+        if (options.backend == InferenceBackend::CUDA) {
+            return options.precision == InferencePrecision::FP16 ? cv::dnn::DNN_TARGET_CUDA_FP16
+                                                                 : cv::dnn::DNN_TARGET_CUDA;
+        }
+#if CV_VERSION_MAJOR > 4 || (CV_VERSION_MAJOR == 4 && CV_VERSION_MINOR >= 9)
+        if (options.precision == InferencePrecision::FP16) {
+            return cv::dnn::DNN_TARGET_CPU_FP16;
+        }
+#endif
+        return cv::dnn::DNN_TARGET_CPU;
+    }
+
+    ClassMask makeClassMask(const set<int> &classesSet) {
+        ClassMask classMask{};
+        for (auto &classId: classesSet) {
+            if (classId >= 0 && classId < static_cast<int>(nClasses)) {
+                classMask[classId] = true;
+            }
+        }
+        return classMask;
+    }
+
     DetectionResult::DetectionResult(int _classId, int _confPercent, cv::Rect2i _bbox) :
             classId(_classId), confPercent(_confPercent), bbox(std::move(_bbox)) {}
 
     string DetectionResult::getLabel() const {
-        return class2name[static_cast<ObjectClass>(classId)] + ": " + std::to_string(confPercent) + "%";
+        return getClassName(classId) + ": " + std::to_string(confPercent) + "%";
     }
 
-    cv::Mat MobileNetSSD::forward(cv::Mat &frame) {
-        _cols = frame.cols;
-        _rows = frame.rows;
+    void MobileNetSSD::prepareInput(const cv::Mat &frame, cv::Mat &input, InputTransform &transform) {
+        transform.cols = frame.cols;
+        transform.rows = frame.rows;
+
+        // MobileNetSSD was trained on 300x300 inputs, so the blob has a fixed size whatever the camera
+        // resolution is. Letterboxing keeps the aspect ratio by padding instead of stretching the frame.
+        if (_letterbox) {
+            transform.scale = std::min(double(_inputSize.width) / frame.cols, double(_inputSize.height) / frame.rows);
+            auto resizedSize = cv::Size2i(static_cast<int>(frame.cols * transform.scale),
+                                          static_cast<int>(frame.rows * transform.scale));
+            transform.padX = (_inputSize.width - resizedSize.width) / 2;
+            transform.padY = (_inputSize.height - resizedSize.height) / 2;
+            cv::resize(frame, _resized, resizedSize, 0, 0, cv::INTER_AREA);
+            cv::copyMakeBorder(_resized, input,
+                               transform.padY, _inputSize.height - resizedSize.height - transform.padY,
+                               transform.padX, _inputSize.width - resizedSize.width - transform.padX,
+                               cv::BORDER_CONSTANT, cv::Scalar(127.5, 127.5, 127.5));
+        } else {
+            transform.scale = 1.;
+            transform.padX = transform.padY = 0;
+            cv::resize(frame, input, _inputSize, 0, 0, cv::INTER_AREA);
+        }
+    }
+
+    void MobileNetSSD::layoutTiles(const size_t &image, const cv::Size2i &frameSize, const cv::Range &band) {
+        if (_tiling.maxInputs < 2) {
+            return;
+        }
+        auto rows = band & cv::Range(0, frameSize.height);
+        if (rows.empty()) {
+            return;
+        }
+        // How many input pixels a source pixel gets, along the axis shrunk the most.
+        auto magnification = [&](const double &width, const double &height) {
+            return std::min(_inputSize.width / width, _inputSize.height / height);
+        };
+        // Past the native resolution more tiles only cost more, so magnifications are capped at 1 and the
+        // layout with the fewest tiles wins among equals.
+        auto best = std::min(1., magnification(frameSize.width, frameSize.height));
+        int bestCols = 0;
+        int bestRows = 0;
+        auto maxTiles = _tiling.maxInputs - 1;
+        for (int nRows = 1; nRows <= maxTiles; nRows++) {
+            for (int nCols = 1; nCols * nRows <= maxTiles; nCols++) {
+                auto tileWidth = frameSize.width / (nCols - (nCols - 1) * _tiling.overlap);
+                auto tileHeight = rows.size() / (nRows - (nRows - 1) * _tiling.overlap);
+                auto value = std::min(1., magnification(tileWidth, tileHeight));
+                if (value > best + 1e-9 || (value > best - 1e-9 && bestCols && nCols * nRows < bestCols * bestRows)) {
+                    best = value;
+                    bestCols = nCols;
+                    bestRows = nRows;
+                }
+            }
+        }
+        if (bestCols == 0) {
+            return;
+        }
+        auto tileWidth = std::min(frameSize.width, static_cast<int>(
+                std::ceil(frameSize.width / (bestCols - (bestCols - 1) * _tiling.overlap))));
+        auto tileHeight = std::min(rows.size(), static_cast<int>(
+                std::ceil(rows.size() / (bestRows - (bestRows - 1) * _tiling.overlap))));
+        // Tiles are spread evenly from one border of the band to the other.
+        for (int row = 0; row < bestRows; row++) {
+            auto y = bestRows > 1 ? (rows.size() - tileHeight) * row / (bestRows - 1) : 0;
+            for (int col = 0; col < bestCols; col++) {
+                auto x = bestCols > 1 ? (frameSize.width - tileWidth) * col / (bestCols - 1) : 0;
+                InputTransform transform;
+                transform.image = image;
+                transform.tile = cv::Rect2i(x, rows.start + y, tileWidth, tileHeight);
+                transform.imageSize = frameSize;
+                _transforms.push_back(transform);
+            }
+        }
+    }
+
+    const cv::Mat &MobileNetSSD::forward(const vector<cv::Mat> &frames, const vector<cv::Range> &tileBands) {
+        _transforms.clear();
+        for (size_t i = 0; i < frames.size(); i++) {
+            InputTransform transform;
+            transform.image = i;
+            _transforms.push_back(transform);
+            layoutTiles(i, frames[i].size(), tileBands.empty() ? cv::Range::all() : tileBands[i]);
+        }
+        _inputs.resize(_transforms.size());
+        for (size_t i = 0; i < _transforms.size(); i++) {
+            auto &transform = _transforms[i];
+            auto &frame = frames[transform.image];
+            prepareInput(transform.tile.empty() ? frame : frame(transform.tile), _inputs[i], transform);
+        }
 
-        auto blob = cv::dnn::blobFromImage(frame, 1.0 / 255, cv::Size_<int>(_cols, _rows), 127.5);
-        _net.setInput(blob);
-        return std::move(_net.forward());
+        cv::dnn::blobFromImages(_inputs, _blob, 1.0 / 255, _inputSize, 127.5);
+        _net.setInput(_blob);
+        _net.forward(_out);
+        return _out;
     }
 
-    cv::Rect2i MobileNetSSD::getDetectedObjBox(const cv::Mat &frame, const cv::Vec<float, 7> &classVec) const {
-        int xLeftBottom = static_cast<int>( static_cast<int>(classVec[3] * float(_cols)) );
-        int yLeftBottom = static_cast<int>( static_cast<int>(classVec[4] * float(_rows)) );
-        int xRightTop = static_cast<int>( static_cast<int>(classVec[5] * float(_cols)) );
-        int yRightTop = static_cast<int>( static_cast<int>(classVec[6] * float(_rows)) );
+    cv::Rect2i MobileNetSSD::getDetectedObjBox(const InputTransform &transform,
+                                               const cv::Vec<float, 7> &classVec) const {
+        auto toSourceX = [&](const float &value) {
+            auto x = _letterbox ? (value * float(_inputSize.width) - transform.padX) / transform.scale
+                                : value * float(transform.cols);
+            return std::clamp(static_cast<int>(x), 0, transform.cols - 1);
+        };
+        auto toSourceY = [&](const float &value) {
+            auto y = _letterbox ? (value * float(_inputSize.height) - transform.padY) / transform.scale
+                                : value * float(transform.rows);
+            return std::clamp(static_cast<int>(y), 0, transform.rows - 1);
+        };
+        int xLeftBottom = toSourceX(classVec[3]);
+        int yLeftBottom = toSourceY(classVec[4]);
+        int xRightTop = toSourceX(classVec[5]);
+        int yRightTop = toSourceY(classVec[6]);
 
         return cv::Rect2i(cv::Point2i(xLeftBottom, yLeftBottom), cv::Point2i(xRightTop, yRightTop));
     }
 
+    static double getElapsedMs(const std::chrono::steady_clock::time_point &from,
+                               const std::chrono::steady_clock::time_point &to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
     void MobileNetSSD::loadModel(const string &modelPath) {
-        _net = cv::dnn::readNetFromCaffe(
-                modelPath + "/MobileNetSSD_deploy.prototxt",
-                modelPath + "/MobileNetSSD_deploy.caffemodel");
-    }
-
-    vector<DetectionResult> MobileNetSSD::detectObjects(
-            cv::Mat &frame,
-            const set<int> &classesSet,
-            const float &confCoefficient) {
-        vector<DetectionResult> detectedObjects;
-        auto out = forward(frame);
-        for (int i = 0; i < out.size[2]; i++) {
-            auto classVec = out.at<cv::Vec<float, 7>>(0, 0, i);
-            auto classId = static_cast<int>(classVec[1]);
-            auto confidence = classVec[2];
-            if (confidence > confCoefficient && classesSet.find(classId) != classesSet.end()) {
-                int confPercent = int(100 * confidence);
-                auto bbox = getDetectedObjBox(frame, classVec);
-                detectedObjects.emplace_back(DetectionResult(classId, confPercent, bbox));
+        auto hasExtension = [&](const string &extension) {
+            return modelPath.size() > extension.size() &&
+                   modelPath.compare(modelPath.size() - extension.size(), extension.size(), extension) == 0;
+        };
+        auto startTime = std::chrono::steady_clock::now();
+        // Model files are parsed from memory mappings; OpenCV copies the weights into its own blobs,
+        // so the mappings are dropped once the network is built.
+        if (hasExtension(".onnx")) {
+            MappedFile model(modelPath);
+            _net = cv::dnn::readNetFromONNX(model.data(), model.size());
+        } else if (hasExtension(".xml")) {
+            // OpenVINO reads the IR itself and already maps the weights.
+            _net = cv::dnn::readNetFromModelOptimizer(modelPath, modelPath.substr(0, modelPath.size() - 4) + ".bin");
+        } else {
+            if (_inference.precision == InferencePrecision::INT8) {
+                throw std::runtime_error("INT8 inference needs a quantized ONNX or OpenVINO IR model");
+            }
+            MappedFile prototxt(modelPath + "/MobileNetSSD_deploy.prototxt");
+            MappedFile caffemodel(modelPath + "/MobileNetSSD_deploy.caffemodel");
+            _net = cv::dnn::readNetFromCaffe(prototxt.data(), prototxt.size(), caffemodel.data(), caffemodel.size());
+        }
+        auto readTime = std::chrono::steady_clock::now();
+
+        auto backend = getDnnBackend(_inference);
+        auto target = getDnnTarget(_inference);
+        auto available = cv::dnn::getAvailableBackends();
+        if (std::find(available.begin(), available.end(), std::make_pair(backend, target)) == available.end()) {
+            throw std::runtime_error("inference backend and precision are not available in this OpenCV build");
+        }
+        _net.setPreferableBackend(backend);
+        _net.setPreferableTarget(target);
+        if (_inference.threads > 0) {
+            cv::setNumThreads(_inference.threads);
+        }
+        _startup.readMs = getElapsedMs(startTime, readTime);
+        _startup.setupMs = getElapsedMs(readTime, std::chrono::steady_clock::now());
+    }
+
+    void MobileNetSSD::warmUp(const int &batchSize) {
+        auto startTime = std::chrono::steady_clock::now();
+        int sizes[] = {batchSize, 3, _inputSize.height, _inputSize.width};
+        _blob.create(4, sizes, CV_32F);
+        _blob.setTo(cv::Scalar(0));
+        _net.setInput(_blob);
+        _net.forward(_out);
+        _startup.warmUpMs = getElapsedMs(startTime, std::chrono::steady_clock::now());
+    }
+
+    void MobileNetSSD::setInferenceOptions(const InferenceOptions &options) {
+        _inference = options;
+    }
+
+    void MobileNetSSD::setInputSize(const cv::Size2i &inputSize, const bool &letterbox) {
+        _inputSize = inputSize;
+        _letterbox = letterbox;
+    }
+
+    void MobileNetSSD::setTiling(const TilingOptions &tiling) {
+        _tiling = tiling;
+    }
+
+    int MobileNetSSD::getInputCount(const cv::Size2i &frameSize, const cv::Range &tileBand) {
+        _transforms.clear();
+        layoutTiles(0, frameSize, tileBand);
+        return 1 + static_cast<int>(_transforms.size());
+    }
+
+    void MobileNetSSD::detectObjects(
+            const cv::Mat &frame,
+            const ClassMask &classMask,
+            const float &confCoefficient,
+            vector<DetectionResult> &detectedObjects,
+            const cv::Range &tileBand) {
+        _frames.resize(1);
+        _frames.front() = frame;
+        _tileBands.resize(1);
+        _tileBands.front() = tileBand;
+        _detections.resize(1);
+        std::swap(_detections.front(), detectedObjects);
+        detectObjects(_frames, classMask, confCoefficient, _detections, _tileBands);
+        std::swap(_detections.front(), detectedObjects);
+        // Do not keep the caller's frame alive until the next call.
+        _frames.front().release();
+    }
+
+    void MobileNetSSD::detectObjects(
+            const vector<cv::Mat> &frames,
+            const ClassMask &classMask,
+            const float &confCoefficient,
+            vector<vector<DetectionResult>> &detectedObjects,
+            const vector<cv::Range> &tileBands) {
+        decodeDetections(forward(frames, tileBands), _transforms, classMask, confCoefficient, detectedObjects);
+    }
+
+    // A box reaching a tile border that is not a border of the frame shows only part of an object. With
+    // enough overlap the whole object is in a neighbouring tile, and large ones are in the whole frame.
+    static bool isCutByTile(const InputTransform &transform, const cv::Rect2i &bbox) {
+        auto &tile = transform.tile;
+        return (tile.x > 0 && bbox.x <= tileCutMargin) ||
+               (tile.y > 0 && bbox.y <= tileCutMargin) ||
+               (tile.x + tile.width < transform.imageSize.width &&
+                bbox.x + bbox.width >= tile.width - 1 - tileCutMargin) ||
+               (tile.y + tile.height < transform.imageSize.height &&
+                bbox.y + bbox.height >= tile.height - 1 - tileCutMargin);
+    }
+
+    // Greedy non-maximum suppression per class, in place. Sorting by class first keeps the pairwise
+    // comparisons within a class, which keeps it cheap with many candidates of different classes.
+    static void suppressDuplicates(vector<DetectionResult> &objects) {
+        std::sort(objects.begin(), objects.end(), [](const DetectionResult &a, const DetectionResult &b) {
+            return a.classId != b.classId ? a.classId < b.classId : a.confPercent > b.confPercent;
+        });
+        size_t kept = 0;
+        size_t classBegin = 0;
+        for (size_t i = 0; i < objects.size(); i++) {
+            if (objects[i].classId != objects[classBegin].classId) {
+                classBegin = kept;
+            }
+            bool duplicate = std::any_of(objects.begin() + classBegin, objects.begin() + kept,
+                                         [&](const DetectionResult &obj) {
+                                             return iou(obj.bbox, objects[i].bbox) > nmsThreshold;
+                                         });
+            if (!duplicate) {
+                if (kept != i) {
+                    objects[kept] = objects[i];
+                }
+                kept++;
+            }
+        }
+        objects.erase(objects.begin() + kept, objects.end());
+    }
+
+    void MobileNetSSD::decodeDetections(
+            const cv::Mat &out,
+            const vector<InputTransform> &transforms,
+            const ClassMask &classMask,
+            const float &confCoefficient,
+            vector<vector<DetectionResult>> &detectedObjects) {
+        // Inner vectors are cleared rather than replaced to keep their capacity.
+        detectedObjects.resize(transforms.empty() ? 0 : transforms.back().image + 1);
+        for (auto &frameObjects: detectedObjects) {
+            frameObjects.clear();
+        }
+        // Detections of the whole batch come in one 1x1xNx7 blob of contiguous rows
+        // [input index, class, confidence, left, top, right, bottom].
+        auto nRows = static_cast<int>(out.total() / 7);
+        auto *rows = out.ptr<float>();
+        auto nInputs = static_cast<unsigned>(transforms.size());
+        if (_candidates.size() < static_cast<size_t>(nRows)) {
+            _candidates.resize(nRows);
+        }
+        // Most rows are below the confidence threshold, so they are compacted without branching: every
+        // row index is written and the output position only moves on when the row passes the filters.
+        // Rows are 7 floats apart, which leaves little to SIMD; at a few nanoseconds a row the pass is
+        // negligible next to the forward pass (see decode_detections_sparse in the kernels benchmark).
+        int nCandidates = 0;
+        for (int i = 0; i < nRows; i++) {
+            auto *row = rows + 7 * i;
+            auto inputId = static_cast<unsigned>(static_cast<int>(row[0]));
+            auto classId = static_cast<unsigned>(static_cast<int>(row[1]));
+            bool pass = (row[2] > confCoefficient) & (inputId < nInputs) & (classId < nClasses) &
+                        classMask[std::min<unsigned>(classId, nClasses - 1)];
+            _candidates[nCandidates] = i;
+            nCandidates += pass;
+        }
+
+        for (int c = 0; c < nCandidates; c++) {
+            auto classVec = out.at<cv::Vec<float, 7>>(0, 0, _candidates[c]);
+            auto &transform = transforms[static_cast<int>(classVec[0])];
+            auto bbox = getDetectedObjBox(transform, classVec);
+            if (!transform.tile.empty()) {
+                if (isCutByTile(transform, bbox)) {
+                    continue;
+                }
+                bbox.x += transform.tile.x;
+                bbox.y += transform.tile.y;
+            }
+            auto &frameObjects = detectedObjects[transform.image];
+            if (frameObjects.capacity() < static_cast<size_t>(nCandidates)) {
+                frameObjects.reserve(nCandidates);
+            }
+            frameObjects.emplace_back(static_cast<int>(classVec[1]), int(100 * classVec[2]), bbox);
+        }
+        for (auto &frameObjects: detectedObjects) {
+            if (frameObjects.size() > 1) {
+                suppressDuplicates(frameObjects);
             }
         }
-        return detectedObjects;
     }
 
 }; // namespace detector
@@ -1,3 +1,6 @@
+#pragma once
+
+#include <array>
 #include <iostream>
 #include <utility>
 #include <iostream>
@@ -40,6 +43,16 @@ namespace detector {
         TV_MONITOR
     };
 
+    [[nodiscard]] string getClassName(const int &classId);
+
+    // Classes MobileNetSSD was trained on, background included.
+    constexpr size_t nClasses = static_cast<size_t>(ObjectClass::TV_MONITOR) + 1;
+
+    // Detected classes as a lookup table, built once from the configured set.
+    using ClassMask = std::array<bool, nClasses>;
+
+    [[nodiscard]] ClassMask makeClassMask(const set<int> &classesSet);
+
     struct DetectionResult {
         int classId;
         int confPercent;
@@ -50,23 +63,137 @@ namespace detector {
         [[nodiscard]] string getLabel() const;
     };
 
+    // Maps network outputs, relative to the input blob, back onto the source frame.
+    struct InputTransform {
+        int cols{};
+        int rows{};
+        double scale = 1.;
+        int padX{};
+        int padY{};
+        // Frame of the batch the input was made of, and the part of it when the input is a tile.
+        size_t image{};
+        cv::Rect2i tile;
+        cv::Size2i imageSize;
+    };
+
+    enum class InferenceBackend : int {
+        OPENCV = 0,
+        OPENVINO,
+        CUDA
+    };
+
+    enum class InferencePrecision : int {
+        FP32 = 0,
+        FP16,
+        INT8
+    };
+
+    [[nodiscard]] bool parseInferenceBackend(const string &name, InferenceBackend &backend);
+
+    [[nodiscard]] bool parseInferencePrecision(const string &name, InferencePrecision &precision);
+
+    // Where and how the network runs. INT8 runs the weights the model file comes with, so it needs a
+    // quantized model; the other precisions convert FP32 weights when the network is set up.
+    struct InferenceOptions {
+        InferenceBackend backend = InferenceBackend::OPENCV;
+        InferencePrecision precision = InferencePrecision::FP32;
+        // Threads of OpenCV's parallel loops, the network included. 0 keeps OpenCV's default.
+        int threads = 0;
+    };
+
+    // Whether the backend offers the precision at all; whether this OpenCV build has it is only known
+    // when the model is loaded.
+    [[nodiscard]] bool isInferenceSupported(const InferenceOptions &options);
+
+    // Durations of the startup phases of the model, in milliseconds.
+    struct ModelStartup {
+        double readMs = 0.;
+        double setupMs = 0.;
+        double warmUpMs = 0.;
+    };
+
+    // Detection on overlapping tiles in addition to the whole frame, so that distant objects still have
+    // enough pixels once resized to the network input. All inputs of a frame go through one forward pass.
+    struct TilingOptions {
+        // Network inputs per frame, the whole frame included, which bounds the cost of a detection.
+        // The layout magnifying the tiles the most within it is used; 1 disables tiling.
+        int maxInputs = 1;
+        // Share of a tile covered by its neighbour, objects smaller than it are entirely in some tile.
+        double overlap = 0.2;
+    };
+
     class MobileNetSSD {
     private:
 
         cv::dnn::Net _net;
 
-        int _cols{};
-        int _rows{};
+        cv::Size2i _inputSize{300, 300};
+        bool _letterbox = false;
+        TilingOptions _tiling;
+        InferenceOptions _inference;
+        ModelStartup _startup;
 
-        cv::Mat forward(cv::Mat &frame);
+        // Buffers of the last call, reused by the next one.
+        cv::Mat _resized;
+        vector<cv::Mat> _inputs;
+        vector<InputTransform> _transforms;
+        cv::Mat _blob;
+        cv::Mat _out;
+        vector<cv::Mat> _frames;
+        vector<cv::Range> _tileBands;
+        vector<vector<DetectionResult>> _detections;
+        vector<int> _candidates;
 
-        [[nodiscard]] cv::Rect2i getDetectedObjBox(const cv::Mat &frame, const cv::Vec<float, 7> &classVec) const;
+        void prepareInput(const cv::Mat &frame, cv::Mat &input, InputTransform &transform);
+
+        // Appends the tiles of a frame, restricted to the rows of band, to _transforms.
+        void layoutTiles(const size_t &image, const cv::Size2i &frameSize, const cv::Range &band);
+
+        const cv::Mat &forward(const vector<cv::Mat> &frames, const vector<cv::Range> &tileBands);
+
+        [[nodiscard]] cv::Rect2i getDetectedObjBox(const InputTransform &transform,
+                                                   const cv::Vec<float, 7> &classVec) const;
 
     public:
 
+        // modelPath is either the folder of the Caffe model, an .onnx file or the .xml file of an OpenVINO
+        // IR (with its .bin next to it). The network's output must be the 1x1xNx7 SSD detection output.
         void loadModel(const string &modelPath);
 
-        vector<DetectionResult> detectObjects(cv::Mat &frame, const set<int> &classesSet, const float &confCoefficient);
+        // Must be set before the model is loaded.
+        void setInferenceOptions(const InferenceOptions &options);
+
+        // Runs a forward pass on a blank blob of the configured input size, so that layers are initialized,
+        // weights repacked for the backend and buffers allocated before the first frame needs them.
+        // Buffers are sized for the batch, which should be the one detections will run with.
+        void warmUp(const int &batchSize = 1);
+
+        [[nodiscard]] const ModelStartup &getStartup() const { return _startup; }
+
+        void setInputSize(const cv::Size2i &inputSize, const bool &letterbox);
+
+        void setTiling(const TilingOptions &tiling);
+
+        // Network inputs a frame of frameSize is detected with: the whole frame and its tiles within tileBand.
+        [[nodiscard]] int getInputCount(const cv::Size2i &frameSize, const cv::Range &tileBand = cv::Range::all());
+
+        // Results are written into detectedObjects, whose capacity is reused. Tiles only cover the rows
+        // of tileBand, e.g. the band around the horizon where objects are small.
+        void detectObjects(const cv::Mat &frame, const ClassMask &classMask, const float &confCoefficient,
+                           vector<DetectionResult> &detectedObjects, const cv::Range &tileBand = cv::Range::all());
+
+        // Runs all frames through the network as one NCHW batch, results are written per frame.
+        // tileBands holds one band per frame, or is empty to tile the frames entirely.
+        void detectObjects(const vector<cv::Mat> &frames, const ClassMask &classMask, const float &confCoefficient,
+                           vector<vector<DetectionResult>> &detectedObjects,
+                           const vector<cv::Range> &tileBands = {});
+
+        // Post-processing of a 1x1xNx7 network output: filters detections by class and confidence,
+        // maps their boxes onto the frames described by transforms and suppresses overlapping boxes of
+        // a class, whether they come from one input or from tiles overlapping each other.
+        void decodeDetections(const cv::Mat &out, const vector<InputTransform> &transforms,
+                              const ClassMask &classMask, const float &confCoefficient,
+                              vector<vector<DetectionResult>> &detectedObjects);
 
     };
 
@@ -0,0 +1,75 @@
+#include "motion_filter.hpp"
+
+#include <cmath>
+
+namespace detector {
+
+    // Process noise: how much the position and the velocity may change from one frame to the next.
+    static constexpr double positionProcessNoise = 1.;
+    static constexpr double velocityProcessNoise = 0.05;
+    // Velocity is unknown until a few measurements came in.
+    static constexpr double initialVelocityVariance = 100.;
+    static constexpr double widthSmoothing = 0.2;
+    static constexpr double innovationSmoothing = 0.3;
+
+    void MotionFilter::Axis::reset(const double &measurement, const double &noise) {
+        position = measurement;
+        velocity = 0.;
+        varPosition = noise;
+        covariance = 0.;
+        varVelocity = initialVelocityVariance;
+    }
+
+    void MotionFilter::Axis::predict() {
+        // x' = F x, P' = F P F^T + Q with F = [[1, 1], [0, 1]].
+        position += velocity;
+        varPosition += 2 * covariance + varVelocity + positionProcessNoise;
+        covariance += varVelocity;
+        varVelocity += velocityProcessNoise;
+    }
+
+    double MotionFilter::Axis::correct(const double &measurement, const double &noise) {
+        auto innovation = measurement - position;
+        auto innovationVar = varPosition + noise;
+        auto gainPosition = varPosition / innovationVar;
+        auto gainVelocity = covariance / innovationVar;
+        position += gainPosition * innovation;
+        velocity += gainVelocity * innovation;
+        varVelocity -= gainVelocity * covariance;
+        covariance -= gainPosition * covariance;
+        varPosition -= gainPosition * varPosition;
+        return innovation;
+    }
+
+    void MotionFilter::reset(const cv::Rect2i &bbox) {
+        _x.reset(bbox.x + bbox.width / 2., trackerNoise);
+        _y.reset(bbox.y + bbox.height / 2., trackerNoise);
+        _width = bbox.width;
+        _corrections = 0;
+        _innovation = 0.;
+    }
+
+    void MotionFilter::predict() {
+        _x.predict();
+        _y.predict();
+    }
+
+    void MotionFilter::correct(const cv::Rect2i &bbox, const double &noise, const uint64_t &age) {
+        auto frames = static_cast<double>(age);
+        auto dx = _x.correct(bbox.x + bbox.width / 2. + frames * _x.velocity, noise + frames * frames * _x.varVelocity);
+        auto dy = _y.correct(bbox.y + bbox.height / 2. + frames * _y.velocity, noise + frames * frames * _y.varVelocity);
+        _width += widthSmoothing * (bbox.width - _width);
+        _innovation += innovationSmoothing * (std::hypot(dx, dy) - _innovation);
+        _corrections++;
+    }
+
+    cv::Rect2i MotionFilter::getBbox(const cv::Size2i &size) const {
+        return cv::Rect2i(static_cast<int>(std::lround(_x.position - size.width / 2.)),
+                          static_cast<int>(std::lround(_y.position - size.height / 2.)), size.width, size.height);
+    }
+
+    bool MotionFilter::isStable() const {
+        return _corrections >= 10 && _innovation <= 0.1 * _width;
+    }
+
+} // namespace detector
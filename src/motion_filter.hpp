@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+
+#include "model.hpp"
+
+namespace detector {
+
+    // Constant velocity Kalman filter over an object's centroid, one frame per step. The two axes are
+    // independent, so each one only keeps a 2x2 covariance and the filter lives in a few doubles next
+    // to the rest of the object's state, without any allocation. The width is smoothed alongside to
+    // convert pixels to meters.
+    class MotionFilter {
+    private:
+
+        struct Axis {
+            double position = 0.;
+            double velocity = 0.;
+            double varPosition = 0.;
+            double covariance = 0.;
+            double varVelocity = 0.;
+
+            void reset(const double &measurement, const double &noise);
+
+            void predict();
+
+            // Returns the innovation, i.e. how far the measurement was from the prediction.
+            double correct(const double &measurement, const double &noise);
+        };
+
+        Axis _x;
+        Axis _y;
+        double _width = 0.;
+        uint32_t _corrections = 0;
+        // Running average of the distance between measurements and predictions.
+        double _innovation = 0.;
+
+    public:
+
+        // Measurement noise of tracker and detector boxes, as variances in square pixels.
+        static constexpr double trackerNoise = 4.;
+        static constexpr double detectorNoise = 16.;
+
+        void reset(const cv::Rect2i &bbox);
+
+        void predict();
+
+        // A box measured age frames ago is carried forward along the filtered velocity, and the
+        // uncertainty of the velocity over that span is added to its noise.
+        void correct(const cv::Rect2i &bbox, const double &noise, const uint64_t &age = 0);
+
+        [[nodiscard]] cv::Point2d getPosition() const { return {_x.position, _y.position}; }
+
+        // In pixels per frame.
+        [[nodiscard]] cv::Point2d getVelocity() const { return {_x.velocity, _y.velocity}; }
+
+        [[nodiscard]] double getWidth() const { return _width; }
+
+        // Box of the given size centred at the filtered position.
+        [[nodiscard]] cv::Rect2i getBbox(const cv::Size2i &size) const;
+
+        // The velocity has settled and recent measurements landed close to the predictions, so the
+        // position can be predicted for a few frames without measuring it.
+        [[nodiscard]] bool isStable() const;
+
+    };
+
+} // namespace detector
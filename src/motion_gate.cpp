@@ -0,0 +1,100 @@
+#include "motion_gate.hpp"
+
+#include <cmath>
+
+namespace detector {
+
+    // Frames are compared at this width, enough to see a pedestrian in a 1080p frame.
+    static constexpr int gateWidth = 160;
+    static constexpr int tileSize = 10;
+    // Share of changed pixels for a tile to count as moving, so that sensor noise left after the blur
+    // does not wake the detector up.
+    static constexpr double minTileChange = 0.02;
+
+    void MotionGate::setThreshold(const int &threshold) {
+        _threshold = threshold;
+    }
+
+    void MotionGate::setMetrics(Metrics *metrics) {
+        _metrics = metrics;
+    }
+
+    void MotionGate::record(const bool &skipped, const uint64_t &pixels, const uint64_t &skippedPixels) {
+        _checks++;
+        _skipped += skipped;
+        _pixels += pixels;
+        _skippedPixels += skippedPixels;
+        if (_metrics) {
+            _metrics->addMotionGateCheck(skipped, pixels, skippedPixels);
+        }
+    }
+
+    bool MotionGate::check(const cv::Mat &frame, const cv::Rect2i &roi, cv::Rect2i &detectionRoi) {
+        auto area = roi.empty() ? cv::Rect2i(0, 0, frame.cols, frame.rows) : roi;
+        auto width = std::min(gateWidth, frame.cols);
+        auto scale = double(frame.cols) / width;
+        auto height = std::max(1, int(std::lround(frame.rows / scale)));
+        cv::resize(frame, _small, cv::Size2i(width, height), 0, 0, cv::INTER_AREA);
+        if (_small.channels() == 3) {
+            cv::cvtColor(_small, _gray, cv::COLOR_BGR2GRAY);
+        } else {
+            _small.copyTo(_gray);
+        }
+        cv::GaussianBlur(_gray, _gray, cv::Size2i(5, 5), 0);
+        _pending = true;
+
+        if (_reference.size() != _gray.size()) {
+            detectionRoi = roi;
+            record(false, area.area(), 0);
+            return true;
+        }
+        cv::absdiff(_gray, _reference, _diff);
+        cv::threshold(_diff, _diff, _threshold, 255, cv::THRESH_BINARY);
+
+        auto smallArea = cv::Rect2i(int(area.x / scale), int(area.y / scale),
+                                    int(std::ceil(area.width / scale)), int(std::ceil(area.height / scale))) &
+                         cv::Rect2i(0, 0, width, height);
+        cv::Rect2i motion;
+        for (int y = smallArea.y; y < smallArea.y + smallArea.height; y += tileSize) {
+            for (int x = smallArea.x; x < smallArea.x + smallArea.width; x += tileSize) {
+                auto tile = cv::Rect2i(x, y, tileSize, tileSize) & smallArea;
+                if (cv::countNonZero(_diff(tile)) > minTileChange * tile.area()) {
+                    motion |= tile;
+                }
+            }
+        }
+        if (motion.empty()) {
+            _pending = false;
+            record(true, area.area(), area.area());
+            return false;
+        }
+        motion = cv::Rect2i(motion.x - tileSize, motion.y - tileSize,
+                            motion.width + 2 * tileSize, motion.height + 2 * tileSize);
+        detectionRoi = cv::Rect2i(int(motion.x * scale), int(motion.y * scale),
+                                  int(std::ceil(motion.width * scale)), int(std::ceil(motion.height * scale))) & area;
+        if (detectionRoi == cv::Rect2i(0, 0, frame.cols, frame.rows)) {
+            detectionRoi = cv::Rect2i();
+        }
+        auto detectedPixels = detectionRoi.empty() ? uint64_t(area.area()) : uint64_t(detectionRoi.area());
+        record(false, area.area(), area.area() - detectedPixels);
+        return true;
+    }
+
+    void MotionGate::commit() {
+        if (_pending) {
+            // The old reference becomes the buffer of the next check.
+            std::swap(_gray, _reference);
+            _pending = false;
+        }
+    }
+
+    void MotionGate::report(const string &name) const {
+        if (_checks == 0) {
+            return;
+        }
+        std::clog << name << ": " << _skipped << " of " << _checks << " detections skipped ("
+                  << 100. * _skipped / _checks << "%), " << 100. * _skippedPixels / std::max<uint64_t>(_pixels, 1)
+                  << "% of pixels not detected" << std::endl;
+    }
+
+} // namespace detector
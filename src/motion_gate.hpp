@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+
+#include "metrics.hpp"
+#include "model.hpp"
+
+namespace detector {
+
+    // Cheap pre-stage of the detector: the frame about to be detected is compared with the one last sent to
+    // the detector on a small blurred grayscale copy. Without any change the detection is skipped, otherwise
+    // the detector only runs on the bounding box of the changed tiles, grown by one tile of context.
+    // Comparing with the last detected frame rather than the previous one lets slow changes (lighting,
+    // an object creeping in) accumulate until they trigger a detection.
+    class MotionGate {
+    private:
+
+        int _threshold = 25;
+        Metrics *_metrics = nullptr;
+
+        cv::Mat _small;
+        cv::Mat _gray;
+        cv::Mat _reference;
+        cv::Mat _diff;
+        bool _pending = false;
+
+        uint64_t _checks = 0;
+        uint64_t _skipped = 0;
+        uint64_t _pixels = 0;
+        uint64_t _skippedPixels = 0;
+
+        void record(const bool &skipped, const uint64_t &pixels, const uint64_t &skippedPixels);
+
+    public:
+
+        // Minimal difference of a pixel's gray level to count as changed.
+        void setThreshold(const int &threshold);
+
+        void setMetrics(Metrics *metrics);
+
+        // Whether the frame needs to be detected, and on which part of it. roi restricts the comparison
+        // and is the whole frame when empty, as is detectionRoi when the whole roi has to be detected.
+        // The first frame is always detected.
+        bool check(const cv::Mat &frame, const cv::Rect2i &roi, cv::Rect2i &detectionRoi);
+
+        // Makes the frame of the last positive check the reference, once it was actually submitted.
+        void commit();
+
+        // Share of detections skipped and of pixels the detector did not have to look at.
+        void report(const string &name) const;
+
+    };
+
+} // namespace detector
@@ -0,0 +1,241 @@
+#include "multi_stream.hpp"
+
+namespace detector {
+
+    StreamState::StreamState(const double &minTrackingQuality) : multiTracker(minTrackingQuality) {}
+
+    void MultiStreamProcessor::setMetrics(Metrics *metrics) {
+        _metrics = metrics;
+        if (_detectorWorker) {
+            _detectorWorker->setMetrics(metrics);
+        }
+        for (auto &stream: _streams) {
+            stream->multiTracker.setMetrics(metrics);
+            stream->motionGate.setMetrics(metrics);
+        }
+    }
+
+    void MultiStreamProcessor::setRoiConfigs(const vector<string> &fileNames) {
+        _roiConfigFileNames = fileNames;
+    }
+
+    void MultiStreamProcessor::openVideoSources(const vector<string> &videoSources) {
+        for (auto &videoSrc: videoSources) {
+            auto stream = std::make_unique<StreamState>(minTrackingQuality);
+            stream->videoSrc = videoSrc;
+            auto startTime = steady_clock::now();
+            if (!openCapture(stream->cap, videoSrc, _captureOptions)) {
+                std::cerr << "Cannot open the video file: " << videoSrc << std::endl;
+                exit(-1);
+            }
+            std::clog << "Opened video source #" << _streams.size() << ": " << videoSrc << " in "
+                      << duration<double, std::milli>(steady_clock::now() - startTime).count() << " ms" << std::endl;
+            double dWidth = stream->cap.get(cv::CAP_PROP_FRAME_WIDTH);
+            double dHeight = stream->cap.get(cv::CAP_PROP_FRAME_HEIGHT);
+            std::clog << "Frame size : " << dWidth << " x " << dHeight << std::endl;
+            stream->frameSize = cv::Size2i(dWidth, dHeight);
+            stream->frameRate.reset(stream->cap);
+
+            auto roiConfigFileName = _streams.size() < _roiConfigFileNames.size() ?
+                                     _roiConfigFileNames[_streams.size()] : string();
+            configureSource(stream->multiTracker, stream->motionGate, roiConfigFileName, stream->frameSize);
+            _streams.push_back(std::move(stream));
+        }
+        // A round detects the frames of all streams at once.
+        int batchSize = 0;
+        for (auto &stream: _streams) {
+            batchSize += _net.getInputCount(stream->frameSize, stream->multiTracker.getRoiMask().getTileBand());
+        }
+        warmUpModel(batchSize);
+    }
+
+    string MultiStreamProcessor::getStreamFileName(const string &outFileName, const size_t &stream) {
+        auto dotPos = outFileName.find_last_of('.');
+        auto slashPos = outFileName.find_last_of('/');
+        if (dotPos == string::npos || (slashPos != string::npos && dotPos < slashPos)) {
+            return outFileName + "_" + std::to_string(stream);
+        }
+        return outFileName.substr(0, dotPos) + "_" + std::to_string(stream) + outFileName.substr(dotPos);
+    }
+
+    void MultiStreamProcessor::detectStreams() {
+        if (_detectorWorker->poll(_detectionJobs)) {
+            for (auto &job: _detectionJobs) {
+                auto &stream = *_streams[job.stream];
+                if (stream.finished) {
+                    continue;
+                }
+                stream.multiTracker.addTrackers(job.frame, stream.packet.frame, job.detectedObjects,
+                                                job.trackedBboxes, stream.packet.seq - job.seq, job.roi);
+            }
+        }
+        if (_round < _nextDetectionRound || !_detectorWorker->isIdle()) {
+            return;
+        }
+        size_t nJobs = 0;
+        for (auto &stream: _streams) {
+            stream->detectionPending = false;
+            if (stream->finished) {
+                continue;
+            }
+            auto &roi = stream->multiTracker.getRoiMask().getDetectionRoi();
+            if (!_useMotionGate) {
+                stream->detectionRoi = roi;
+            } else if (!stream->motionGate.check(stream->packet.frame, roi, stream->detectionRoi)) {
+                stream->gatedOut = true;
+                continue;
+            }
+            stream->detectionPending = true;
+            nJobs++;
+        }
+        if (nJobs == 0) {
+            // Nothing moved in any stream since its last detection.
+            _nextDetectionRound = _round + _detectInterval;
+            return;
+        }
+        _detectionJobs.resize(nJobs);
+        size_t jobIdx = 0;
+        for (size_t i = 0; i < _streams.size(); i++) {
+            auto &stream = *_streams[i];
+            if (!stream.detectionPending) {
+                continue;
+            }
+            auto &job = _detectionJobs[jobIdx++];
+            job.stream = i;
+            job.seq = stream.packet.seq;
+            stream.packet.frame.copyTo(job.frame);
+            job.roi = stream.detectionRoi;
+            job.tileBand = stream.multiTracker.getRoiMask().getTileBand();
+            stream.multiTracker.getObjectBboxes(job.trackedBboxes);
+            job.detectedObjects.clear();
+        }
+        if (_detectorWorker->trySubmit(_detectionJobs)) {
+            _nextDetectionRound = _round + _detectInterval;
+            for (auto &stream: _streams) {
+                if (stream->detectionPending) {
+                    stream->gatedOut = false;
+                    stream->motionGate.commit();
+                }
+            }
+        }
+    }
+
+    void MultiStreamProcessor::run(const string &outFileName, const bool &displayNamedWindow) {
+        for (size_t i = 0; i < _streams.size(); i++) {
+            auto &stream = *_streams[i];
+            if (!outFileName.empty()) {
+                stream.writer.open(getStreamFileName(outFileName, i),
+                                   cv::VideoWriter::fourcc('D', 'I', 'V', '3'), 15, stream.frameSize, true);
+            }
+            if (displayNamedWindow) {
+                cv::namedWindow("Video tracker #" + std::to_string(i), cv::WINDOW_AUTOSIZE);
+            }
+            stream.lastFrameTime = steady_clock::now();
+        }
+
+        // Without a window there is nothing to wait for, rounds run back to back until every source ends.
+        FrameStats stats;
+        size_t activeStreams = _streams.size();
+        while (activeStreams > 0) {
+            auto roundStartTime = steady_clock::now();
+            for (auto &stream: _streams) {
+                if (stream->finished) {
+                    continue;
+                }
+                bool bSuccess;
+                {
+                    ScopedStageTimer decodeTimer(_metrics, Stage::DECODE);
+                    stream->packet.captureTime = steady_clock::now();
+                    bSuccess = stream->cap.read(stream->packet.frame);
+                }
+                if (!bSuccess) {
+                    std::clog << "No more frames in video source: " << stream->videoSrc << std::endl;
+                    stream->finished = true;
+                    activeStreams--;
+                    continue;
+                }
+                ScopedStageTimer trackTimer(_metrics, Stage::TRACK);
+                stream->multiTracker.update(stream->packet.frame);
+                if (stream->gatedOut) {
+                    stream->multiTracker.holdObjects();
+                }
+            }
+
+            // Detection is shared by all streams: one batch per round, whenever the network is idle.
+            detectStreams();
+
+            for (size_t i = 0; i < _streams.size(); i++) {
+                auto &stream = *_streams[i];
+                if (stream.finished) {
+                    continue;
+                }
+                auto &packet = stream.packet;
+                auto now = steady_clock::now();
+                auto duration = duration_cast<microseconds>(now - stream.lastFrameTime).count();
+                stream.lastFrameTime = now;
+                packet.fps = 1000000. / std::max<long>(duration, 1);
+                stream.frameRate.addFrame(packet.captureTime);
+                stream.multiTracker.updateSpeeds(stream.frameRate.get());
+                if (_eventWriter) {
+                    _eventWriter->record(stream.multiTracker, uint32_t(i), packet.seq);
+                }
+                logObjectCounters(stream.multiTracker, packet.seq);
+                collectOverlays(stream.multiTracker, packet);
+                {
+                    ScopedStageTimer overlayTimer(_metrics, Stage::OVERLAY);
+                    renderFrame(packet);
+                }
+                packet.seq++;
+
+                if (stream.writer.isOpened()) {
+                    ScopedStageTimer encodeTimer(_metrics, Stage::ENCODE);
+                    stream.writer.write(packet.frame);
+                }
+                if (displayNamedWindow) {
+                    cv::imshow("Video tracker #" + std::to_string(i), packet.frame);
+                }
+            }
+            if (_metrics) {
+                ObjectCounters total{};
+                for (auto &stream: _streams) {
+                    auto counters = stream->multiTracker.getObjectCounters();
+                    total.live += counters.live;
+                    total.retired += counters.retired;
+                    total.slots += counters.slots;
+                }
+                _metrics->setObjectCounts(total.live, total.retired, total.slots);
+            }
+            if (activeStreams > 0) {
+                auto roundLatency = duration<double, std::milli>(steady_clock::now() - roundStartTime).count();
+                stats.addFrame(roundLatency);
+                // A frame of every stream went through this round, so each of them took the round's time.
+                for (size_t i = 0; _metrics && i < activeStreams; i++) {
+                    _metrics->addFrame(roundLatency);
+                }
+            }
+            if (_round == 0) {
+                std::clog << "First round tracked "
+                          << duration<double, std::milli>(steady_clock::now() - _createdTime).count()
+                          << " ms after startup" << std::endl;
+            }
+            if (displayNamedWindow && cv::waitKey(1) == 27) {
+                std::clog << "Esc key is pressed by user. Bye!" << std::endl;
+                break;
+            }
+            _round++;
+        }
+        std::clog << "Rounds over " << _streams.size() << " video sources:" << std::endl;
+        stats.report();
+        for (size_t i = 0; i < _streams.size(); i++) {
+            _streams[i]->motionGate.report("Motion gate #" + std::to_string(i));
+        }
+
+        if (displayNamedWindow) {
+            cv::destroyAllWindows();
+        }
+        for (auto &stream: _streams) {
+            stream->writer.release();
+        }
+    }
+
+} // namespace detector
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "processor_base.hpp"
+
+namespace detector {
+
+    struct StreamState {
+        string videoSrc;
+        cv::VideoCapture cap;
+        cv::Size2i frameSize;
+        SourceFrameRate frameRate;
+        MultiTracker multiTracker;
+        MotionGate motionGate;
+        // Part of the frame going into the next detection batch, when the stream is part of it.
+        cv::Rect2i detectionRoi;
+        bool detectionPending = false;
+        // The motion gate skipped the stream's last detection, its objects do not age until the next one.
+        bool gatedOut = false;
+        cv::VideoWriter writer;
+        FramePacket packet;
+        steady_clock::time_point lastFrameTime;
+        bool finished = false;
+
+        explicit StreamState(const double &minTrackingQuality);
+    };
+
+    // Processes several video sources in one process with a single MobileNetSSD instance. Every stream
+    // keeps its own MultiTracker; frames of all streams are detected together as one batch on the
+    // DetectorWorker thread and the results are handed back to the stream they came from.
+    class MultiStreamProcessor : public ProcessorBase {
+    private:
+
+        vector<DetectionJob> _detectionJobs;
+        uint64_t _round = 0;
+        uint64_t _nextDetectionRound = 0;
+
+        vector<std::unique_ptr<StreamState>> _streams;
+        vector<string> _roiConfigFileNames;
+
+        void detectStreams();
+
+        static string getStreamFileName(const string &outFileName, const size_t &stream);
+
+    public:
+
+        // Metrics are attached after loadModel so that the detector reports into them too.
+        void setMetrics(Metrics *metrics);
+
+        // One ROI config per video source, in the same order.
+        void setRoiConfigs(const vector<string> &fileNames);
+
+        void openVideoSources(const vector<string> &videoSources);
+
+        void run(const string &outFileName, const bool &displayNamedWindow);
+
+    };
+
+} // namespace detector
@@ -3,94 +3,295 @@
 namespace detector {
 
     MultiTracker::MultiTracker(const double &minTrackingQuality): _minTrackingQuality(minTrackingQuality) {
-        _objTrackers = map<int, dlib::correlation_tracker>();
-        _objLabels = map<int, string>();
-        _objClasses = map<int, int>();
         _currentObjID = 0;
+        _threadPool = std::make_shared<ThreadPool>(1);
     }
 
-    void MultiTracker::update(const dlib::cv_image<dlib::bgr_pixel> &img) {
-        vector<int> objIDsToDelete;
-        for (auto &[objID, tracker]: _objTrackers) {
-            double trackingQuality = tracker.update(img);
-            if (trackingQuality < _minTrackingQuality) {
-                objIDsToDelete.emplace_back(objID);
+    void MultiTracker::setThreadsCount(const size_t &nThreads) {
+        _threadPool = std::make_shared<ThreadPool>(nThreads);
+    }
+
+    void MultiTracker::setThreadPool(std::shared_ptr<ThreadPool> threadPool) {
+        _threadPool = std::move(threadPool);
+    }
+
+    void MultiTracker::setHistoryLimits(const size_t &historyLength, const uint64_t &ttlFrames) {
+        _objects.setHistoryLength(historyLength);
+        _ttlFrames = ttlFrames;
+    }
+
+    void MultiTracker::setAssociation(const AssociationMethod &method, const double &minIou) {
+        _associator.configure(method, minIou);
+    }
+
+    void MultiTracker::setMetrics(Metrics *metrics) {
+        _metrics = metrics;
+    }
+
+    void MultiTracker::setTrackingScale(const double &trackingScale) {
+        _trackingScale = std::clamp(trackingScale, 0.01, 1.);
+    }
+
+    void MultiTracker::setTrackerBackend(const TrackerBackend &backend) {
+        _trackerBackend = backend;
+    }
+
+    void MultiTracker::setMotionModel(const SpeedEstimator &speedEstimator, const size_t &trackerSkip) {
+        _speedDetector.setEstimator(speedEstimator);
+        _trackerSkip = std::max<size_t>(trackerSkip, 1);
+    }
+
+    void MultiTracker::setRoiMask(const RoiMask &roiMask) {
+        _roiMask = roiMask;
+    }
+
+    const RoiMask &MultiTracker::getRoiMask() const {
+        return _roiMask;
+    }
+
+    const cv::Mat &MultiTracker::prepareTrackingImage(const cv::Mat &frame, cv::Mat &scaledImage) {
+        if (!trackerUsesImage(_trackerBackend)) {
+            scaledImage.release();
+            return scaledImage;
+        }
+        if (_trackingScale >= 1.) {
+            return frame;
+        }
+        // Computed once per frame for all trackers: each of them would otherwise resample and convert
+        // the full resolution colour frame on its own.
+        cv::resize(frame, _resizedFrame, cv::Size2i(), _trackingScale, _trackingScale, cv::INTER_AREA);
+        cv::cvtColor(_resizedFrame, scaledImage, cv::COLOR_BGR2GRAY);
+        return scaledImage;
+    }
+
+    cv::Rect2d MultiTracker::toTrackingBbox(const cv::Rect2i &bbox) const {
+        return cv::Rect2d(bbox.x * _trackingScale, bbox.y * _trackingScale,
+                          bbox.width * _trackingScale, bbox.height * _trackingScale);
+    }
+
+    void MultiTracker::update(const cv::Mat &frame) {
+        _frameIndex++;
+        _frameArena.reset();
+        _removedObjects.clear();
+
+        // Trackers are independent of each other, so only their update runs in parallel.
+        // Everything touching shared state - removal and position sampling - is merged afterwards
+        // on this thread in slot order, which keeps the results independent of scheduling.
+        _trackingSucceeded.assign(_objects.capacity(), 0);
+        _trackerScheduled.assign(_objects.capacity(), 0);
+        // Skipped trackers of stable objects are spread over frames by slot, so that the load stays even.
+        bool skipTrackers = _trackerSkip > 1 && trackerUsesImage(_trackerBackend);
+        for (size_t slot = 0; slot < _objects.capacity(); slot++) {
+            if (_objects.isAlive(slot)) {
+                auto &motion = _objects.motion(slot);
+                motion.predict();
+                _trackerScheduled[slot] = !skipTrackers || !motion.isStable() || (_frameIndex + slot) % _trackerSkip == 0;
+            }
+        }
+        auto &trackingImage = prepareTrackingImage(frame, _trackingImage);
+        _threadPool->parallelFor(_objects.capacity(), [&](size_t slot) {
+            if (!_objects.isAlive(slot) || !_trackerScheduled[slot]) {
+                return;
+            }
+            auto &motion = _objects.motion(slot);
+            if (skipTrackers && motion.isStable()) {
+                auto guess = toTrackingBbox(motion.getBbox(_objects.bbox(slot).size()));
+                _trackingSucceeded[slot] = _trackers[slot]->updateWithGuess(trackingImage, guess);
             } else {
-                auto bbox = getObjectBbox(tracker);
-                _speedDetector.addObject(objID, bbox, _objClasses[objID]);
+                _trackingSucceeded[slot] = _trackers[slot]->update(trackingImage);
+            }
+        });
+
+        for (size_t slot = 0; slot < _objects.capacity(); slot++) {
+            if (!_objects.isAlive(slot)) {
+                continue;
+            }
+            auto &motion = _objects.motion(slot);
+            if (!_trackerScheduled[slot]) {
+                _objects.update(slot, motion.getBbox(_objects.bbox(slot).size()));
+            } else if (!_trackingSucceeded[slot]) {
+                std::clog << "Remove tracker ID(" << _objects.objID(slot) << ") from list of trackers" << std::endl;
+                removeSlot(slot);
+            } else {
+                auto bbox = getObjectBbox(*_trackers[slot]);
+                motion.correct(bbox, MotionFilter::trackerNoise);
+                _objects.update(slot, bbox);
+            }
+        }
+        // Trackers may keep following background after their object left, so objects the detector kept
+        // looking at without finding them for too long are retired whatever their trackers report.
+        for (size_t slot = 0; slot < _objects.capacity(); slot++) {
+            if (_objects.isAlive(slot) && _frameIndex - _objects.lastSeenFrame(slot) > _ttlFrames) {
+                std::clog << "Evict object ID(" << _objects.objID(slot) << ") not detected for " << _ttlFrames
+                          << " frames" << std::endl;
+                removeSlot(slot);
             }
         }
-        for (auto &objID: objIDsToDelete) {
-            std::clog << "Remove tracker ID(" << objID << ") from list of trackers" << std::endl;
-            _objTrackers.erase(objID);
+    }
+
+    void MultiTracker::addTrackers(const cv::Mat &frame, const vector<DetectionResult> &detectedObjects) {
+        getObjectBboxes(_currentBboxes);
+        addTrackers(frame, frame, detectedObjects, _currentBboxes, 0);
+    }
+
+    void MultiTracker::holdObjects() {
+        for (size_t slot = 0; slot < _objects.capacity(); slot++) {
+            if (_objects.isAlive(slot)) {
+                _objects.markSeen(slot, _frameIndex);
+            }
         }
     }
 
-    void MultiTracker::addTrackers(const dlib::cv_image<dlib::bgr_pixel> &img,
-                                   const vector<DetectionResult> &detectedObjects) {
-        for (auto &obj : detectedObjects) {
-            auto bbox = obj.bbox;
-            int x = bbox.x;
-            int y = bbox.y;
-            int width = bbox.width;
-            int height = bbox.height;
-
-            int xBar = x + static_cast<int>(0.5 * width);
-            int yBar = y + static_cast<int>(0.5 * height);
-
-            int matchObjID = -1;
-            for (auto &[objID, tracker]: _objTrackers) {
-                auto trackedPosition = tracker.get_position();
-
-                int tx = static_cast<int>(trackedPosition.left());
-                int ty = static_cast<int>(trackedPosition.top());
-                int tWidth = static_cast<int>(trackedPosition.width());
-                int tHeight = static_cast<int>(trackedPosition.height());
-
-                int txBar = tx + static_cast<int>(0.5 * tWidth);
-                int tyBar = ty + static_cast<int>(0.5 * tHeight);
-
-                bool pred = (tx <= xBar) && (xBar <= (tx + tWidth)) &&
-                            (ty <= yBar) && (yBar <= (ty + tHeight)) &&
-                            (x <= txBar) && (txBar <= (x + width)) &&
-                            (y <= tyBar) && (tyBar <= (y + height));
-                if (pred) {
-                    matchObjID = objID;
+    void MultiTracker::addTrackers(const cv::Mat &detectionFrame,
+                                   const cv::Mat &frame,
+                                   const vector<DetectionResult> &detectedObjects,
+                                   const ObjectBboxes &detectionBboxes,
+                                   const uint64_t &detectionAge,
+                                   const cv::Rect2i &detectionRoi) {
+        // Detections describe the frame they were computed on, which may be several frames behind img.
+        // Compare them with tracker positions recorded on that same frame; trackers started after it
+        // have no such record and are compared by their current position.
+        {
+            ScopedStageTimer associateTimer(_metrics, Stage::ASSOCIATE);
+            _trackedBboxes.clear();
+            _trackedSlots.clear();
+            for (size_t slot = 0; slot < _objects.capacity(); slot++) {
+                if (_objects.isAlive(slot)) {
+                    auto objID = _objects.objID(slot);
+                    auto it = std::lower_bound(detectionBboxes.begin(), detectionBboxes.end(), objID,
+                                               [](const pair<int, cv::Rect2i> &entry, const int &id) {
+                                                   return entry.first < id;
+                                               });
+                    auto found = it != detectionBboxes.end() && it->first == objID;
+                    _trackedBboxes.push_back(found ? it->second : _objects.bbox(slot));
+                    _trackedSlots.push_back(slot);
                 }
             }
-            if (matchObjID == -1) {
-                std::clog << "Create new tracker: ID(" << _currentObjID << ")" << std::endl;
-                dlib::correlation_tracker tracker;
-                tracker.start_track(img, dlib::rectangle(x, y, x + width, y + height));
-                _objTrackers[_currentObjID] = tracker;
-                _objLabels[_currentObjID] = obj.getLabel();
-                _objClasses[_currentObjID] = obj.classId;
-                _currentObjID++;
+            _detectedBboxes.clear();
+            for (auto &obj : detectedObjects) {
+                _detectedBboxes.push_back(obj.bbox);
+            }
+            _associator.associate(_detectedBboxes, _trackedBboxes, _detectionToTrack, &_frameArena);
+        }
+        auto detectionFrameIndex = _frameIndex - std::min(detectionAge, _frameIndex);
+        if (!detectionRoi.empty()) {
+            // Objects the detector did not look at could not be found, so they do not age.
+            for (size_t track = 0; track < _trackedSlots.size(); track++) {
+                if ((_trackedBboxes[track] & detectionRoi) != _trackedBboxes[track]) {
+                    _objects.markSeen(_trackedSlots[track], detectionFrameIndex);
+                }
+            }
+        }
+        bool catchUp = detectionFrame.data != frame.data;
+        // The tracking image of frame was made by update(), the one of the detection frame only
+        // when a tracker has to be started on it.
+        auto &trackingImage = _trackingScale >= 1. ? frame : _trackingImage;
+        const cv::Mat *detectionTrackingImage = nullptr;
+
+        _createdBboxes.clear();
+        for (size_t i = 0; i < detectedObjects.size(); i++) {
+            if (_detectionToTrack[i] != -1) {
+                auto slot = _trackedSlots[_detectionToTrack[i]];
+                // Only trackers driven by detections use it, even when it is a few frames old.
+                _trackers[slot]->correct(toTrackingBbox(detectedObjects[i].bbox));
+                _objects.motion(slot).correct(detectedObjects[i].bbox, MotionFilter::detectorNoise, detectionAge);
+                _objects.markSeen(slot, detectionFrameIndex);
+                continue;
+            }
+            auto &bbox = detectedObjects[i].bbox;
+            if (!_roiMask.acceptsDetection(bbox)) {
+                continue;
+            }
+            // The detector may report one object several times, start a single tracker for it.
+            bool duplicate = std::any_of(_createdBboxes.begin(), _createdBboxes.end(), [&](const cv::Rect2i &created) {
+                return iou(bbox, created) >= _associator.minIou();
+            });
+            if (duplicate) {
+                continue;
+            }
+            _createdBboxes.push_back(bbox);
+
+            std::clog << "Create new tracker: ID(" << _currentObjID << ")" << std::endl;
+            if (!detectionTrackingImage) {
+                detectionTrackingImage = catchUp ? &prepareTrackingImage(detectionFrame, _detectionTrackingImage)
+                                                 : &trackingImage;
+            }
+            auto tracker = createObjectTracker(_trackerBackend, _minTrackingQuality, _ttlFrames);
+            tracker->start(*detectionTrackingImage, toTrackingBbox(bbox));
+            if (catchUp) {
+                tracker->update(trackingImage);
+            }
+            auto &obj = detectedObjects[i];
+            auto slot = _objects.add(_currentObjID, getObjectBbox(*tracker), obj.classId,
+                                     float(obj.confPercent) / 100, obj.getLabel(), _frameIndex);
+            if (slot == _trackers.size()) {
+                _trackers.push_back(std::move(tracker));
+            } else {
+                _trackers[slot] = std::move(tracker);
+            }
+            _currentObjID++;
+            if (_metrics) {
+                _metrics->addTrackersCreated(1);
             }
         }
     }
 
-    [[nodiscard]] cv::Rect2i MultiTracker::getObjectBbox(const dlib::correlation_tracker &tracker) {
-        auto trackedPosition = tracker.get_position();
+    [[nodiscard]] cv::Rect2i MultiTracker::getObjectBbox(const ObjectTracker &tracker) const {
+        auto trackedPosition = tracker.getPosition();
 
-        int tx = static_cast<int>(trackedPosition.left());
-        int ty = static_cast<int>(trackedPosition.top());
-        int tWidth = static_cast<int>(trackedPosition.width());
-        int tHeight = static_cast<int>(trackedPosition.height());
+        int tx = static_cast<int>(trackedPosition.x / _trackingScale);
+        int ty = static_cast<int>(trackedPosition.y / _trackingScale);
+        int tWidth = static_cast<int>(trackedPosition.width / _trackingScale);
+        int tHeight = static_cast<int>(trackedPosition.height / _trackingScale);
 
         return cv::Rect2i(tx, ty, tWidth, tHeight);
     }
 
-    [[nodiscard]] map<int, dlib::correlation_tracker> MultiTracker::getTrackers() const {
-        return _objTrackers;
+    void MultiTracker::getObjectBboxes(ObjectBboxes &bboxes) const {
+        bboxes.clear();
+        forEachObject([&](const TrackedObjectView &obj) {
+            bboxes.emplace_back(obj.objID, obj.bbox);
+        });
+        // Slots are reused, so slot order is not ID order.
+        std::sort(bboxes.begin(), bboxes.end(), [](const pair<int, cv::Rect2i> &a, const pair<int, cv::Rect2i> &b) {
+            return a.first < b.first;
+        });
+    }
+
+    void MultiTracker::updateSpeeds(const double &fps) {
+        ScopedStageTimer speedTimer(_metrics, Stage::SPEED);
+        _speedDetector.updateSpeeds(_objects, fps);
+        if (_roiMask.hasMeasurementZones()) {
+            for (size_t slot = 0; slot < _objects.capacity(); slot++) {
+                if (_objects.isAlive(slot) && !_roiMask.isMeasured(_objects.bbox(slot))) {
+                    _objects.setSpeed(slot, -1.);
+                }
+            }
+        }
+    }
+
+    void MultiTracker::removeSlot(const size_t &slot) {
+        _removedObjects.push_back(_objects.objID(slot));
+        _objects.remove(slot);
+        // Drop the filter state now rather than when the slot is reused.
+        _trackers[slot].reset();
+        _retiredObjects++;
+        if (_metrics) {
+            _metrics->addTrackersRemoved(1);
+        }
     }
 
-    [[nodiscard]] map<int, double> MultiTracker::getObjectsSpeed(const double &fps) {
-        return _speedDetector.getObjectsSpeed(fps);
+    void MultiTracker::removeObject(const int &objID) {
+        for (size_t slot = 0; slot < _objects.capacity(); slot++) {
+            if (_objects.isAlive(slot) && _objects.objID(slot) == objID) {
+                removeSlot(slot);
+                return;
+            }
+        }
     }
 
-    [[nodiscard]] string MultiTracker::getLabel(const int &objID) {
-        return _objLabels[objID];
+    [[nodiscard]] ObjectCounters MultiTracker::getObjectCounters() const {
+        return ObjectCounters{_objects.size(), _retiredObjects, _objects.capacity()};
     }
 
 } // namespace detector
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <numeric>
 #include <algorithm>
 #include <thread>
@@ -8,90 +10,157 @@
 #include <dlib/dir_nav.h>
 #include <dlib/opencv/cv_image.h>
 
+#include "association.hpp"
+#include "frame_arena.hpp"
+#include "object_tracker.hpp"
+#include "roi.hpp"
 #include "speed_detector.hpp"
+#include "metrics.hpp"
+#include "thread_pool.hpp"
 
 namespace detector {
 
     using std::map;
+    using std::pair;
     using std::thread;
 
+    struct TrackedObjectView {
+        int objID;
+        const cv::Rect2i &bbox;
+        const string &label;
+        int classId;
+        double speed;
+    };
+
+    struct ObjectCounters {
+        size_t live;
+        uint64_t retired;
+        size_t slots;
+    };
+
     class MultiTracker {
     private:
 
         SpeedDetector _speedDetector;
 
-        map<int, dlib::correlation_tracker> _objTrackers;
-        map<int, int> _objClasses;
-        map<int, string> _objLabels;
+        // Trackers are indexed by the object's slot in _objects.
+        ObjectStore _objects;
+        vector<std::unique_ptr<ObjectTracker>> _trackers;
+        TrackerBackend _trackerBackend = TrackerBackend::DLIB;
 
         double _minTrackingQuality;
         int _currentObjID;
+        uint64_t _retiredObjects = 0;
+        vector<int> _removedObjects;
+        uint64_t _ttlFrames = 30;
+        uint64_t _frameIndex = 0;
+
+        std::shared_ptr<ThreadPool> _threadPool;
+        // Written concurrently by slot, hence not vector<bool>.
+        vector<uint8_t> _trackingSucceeded;
+        vector<uint8_t> _trackerScheduled;
+        size_t _trackerSkip = 1;
+
+        Associator _associator;
+        vector<cv::Rect2i> _trackedBboxes;
+        vector<size_t> _trackedSlots;
+        vector<cv::Rect2i> _detectedBboxes;
+        vector<cv::Rect2i> _createdBboxes;
+        vector<int> _detectionToTrack;
+        ObjectBboxes _currentBboxes;
+
+        // Scratch memory of one frame, reset when the next frame is tracked.
+        FrameArena _frameArena;
+
+        // Trackers run on one image per frame shared by all of them: the frame itself or, with a tracking
+        // scale below 1, its downscaled grayscale copy. Boxes are scaled on the way in and out.
+        // Backends that do not look at frames get an empty image.
+        double _trackingScale = 1.;
+        cv::Mat _resizedFrame;
+        cv::Mat _trackingImage;
+        cv::Mat _detectionTrackingImage;
+
+        const cv::Mat &prepareTrackingImage(const cv::Mat &frame, cv::Mat &scaledImage);
+
+        [[nodiscard]] cv::Rect2d toTrackingBbox(const cv::Rect2i &bbox) const;
+
+        [[nodiscard]] cv::Rect2i getObjectBbox(const ObjectTracker &tracker) const;
+
+        RoiMask _roiMask;
+
+        Metrics *_metrics = nullptr;
+
+        void removeSlot(const size_t &slot);
 
     public:
 
         explicit MultiTracker(const double &minTrackingQuality);
 
-        void update(const dlib::cv_image<dlib::bgr_pixel> &img);
+        void setThreadsCount(const size_t &nThreads);
+
+        void setThreadPool(std::shared_ptr<ThreadPool> threadPool);
+
+        void setHistoryLimits(const size_t &historyLength, const uint64_t &ttlFrames);
+
+        void setAssociation(const AssociationMethod &method, const double &minIou);
+
+        void setMetrics(Metrics *metrics);
+
+        // Scale (0, 1] of the image trackers run on. Must be set before the first tracker is started.
+        void setTrackingScale(const double &trackingScale);
+
+        // Must be set before the first tracker is started.
+        void setTrackerBackend(const TrackerBackend &backend);
+
+        // Image trackers of objects whose motion filter is stable are only updated every trackerSkip
+        // frames; in between their boxes are predicted.
+        void setMotionModel(const SpeedEstimator &speedEstimator, const size_t &trackerSkip);
+
+        // Detections outside the ROI do not start trackers, speeds outside measurement zones are not reported.
+        void setRoiMask(const RoiMask &roiMask);
+
+        [[nodiscard]] const RoiMask &getRoiMask() const;
+
+        void update(const cv::Mat &frame);
+
+        // frame must be the frame last passed to update().
+        void addTrackers(const cv::Mat &frame, const vector<DetectionResult> &detectedObjects);
+
+        // detectionFrame is detectionAge frames older than frame, the frame last passed to update().
+        // detectionRoi is the part of detectionFrame the detector looked at, the whole frame when empty:
+        // only objects inside it age when no detection matches them.
+        void addTrackers(const cv::Mat &detectionFrame,
+                         const cv::Mat &frame,
+                         const vector<DetectionResult> &detectedObjects,
+                         const ObjectBboxes &detectionBboxes,
+                         const uint64_t &detectionAge,
+                         const cv::Rect2i &detectionRoi = cv::Rect2i());
+
+        // The detector skipped the frame last passed to update(), e.g. as nothing moved: no object ages on it.
+        void holdObjects();
+
+        void getObjectBboxes(ObjectBboxes &bboxes) const;
 
-        void addTrackers(const dlib::cv_image<dlib::bgr_pixel> &img, const vector<DetectionResult> &detectedObjects);
+        // Calls f(const TrackedObjectView &) for every tracked object, walking the object table linearly.
+        template<class F>
+        void forEachObject(F &&f) const {
+            for (size_t slot = 0; slot < _objects.capacity(); slot++) {
+                if (_objects.isAlive(slot)) {
+                    f(TrackedObjectView{_objects.objID(slot), _objects.bbox(slot), _objects.label(slot),
+                                        _objects.classId(slot), _objects.speed(slot)});
+                }
+            }
+        }
 
-        [[nodiscard]] static cv::Rect2i getObjectBbox(const dlib::correlation_tracker &tracker);
+        void updateSpeeds(const double &fps);
 
-        [[nodiscard]] map<int, dlib::correlation_tracker> getTrackers() const;
+        void removeObject(const int &objID);
 
-        [[nodiscard]] map<int, double> getObjectsSpeed(const double &fps);
+        // IDs of the objects removed since the start of the last update().
+        [[nodiscard]] const vector<int> &getRemovedObjects() const { return _removedObjects; }
 
-        [[nodiscard]] string getLabel(const int &objID);
+        [[nodiscard]] ObjectCounters getObjectCounters() const;
 
     };
 
-//    class ParallelTracker {
-//    private:
-//
-//        unordered_map<int, MultiTracker> _workerTrackers;
-//        int _nWorkers;
-//        unordered_map<int, int> _workersLoad;
-//
-//        int getWorker() {
-//            int minLoadWorkerID = 0;
-//            int minWorkerLoad = 100;
-//            for (auto &[workerID, workerLoad]: _workersLoad) {
-//                if (workerLoad < minWorkerLoad) {
-//                    minLoadWorkerID = workerID;
-//                }
-//            }
-//            return minLoadWorkerID;
-//        }
-//
-//    public:
-//
-//        explicit ParallelTracker(const int &nWorkers, const double &minTrackingQuality) : _nWorkers(nWorkers) {
-//            _workerTrackers = unordered_map<int, MultiTracker>();
-//            for (int i = 0; i < nWorkers; i++) {
-//                _workerTrackers.insert(std::make_pair(i, MultiTracker(minTrackingQuality)));
-//                _workersLoad[i] = 0;
-//            }
-//        }
-//
-//        void addTrackers(dlib::cv_image<dlib::bgr_pixel> img, vector<DetectionResult> detectedObjects) {
-//
-//        }
-//
-//        void update(dlib::cv_image<dlib::bgr_pixel> img) {
-//            auto threads = vector<std::thread>();
-//            threads.reserve(_nWorkers);
-//            for (int i = 0; i < _nWorkers; i++) {
-//                threads.emplace_back(thread(
-//                        [](MultiTracker &multiTracker, dlib::cv_image<dlib::bgr_pixel> img) {
-//                            multiTracker.update(img);
-//                        }, std::ref(_workerTrackers[i]), img)
-//                );
-//            }
-//            for_each(threads.begin(), threads.end(), [&](std::thread &th) {
-//                th.join();
-//            });
-//        }
-//
-//    };
-
-} // namespace detector
\ No newline at end of file
+} // namespace detector
@@ -0,0 +1,100 @@
+#include "object_store.hpp"
+
+#include <algorithm>
+
+namespace detector {
+
+    int ObjectStore::internLabel(const string &label) {
+        auto it = _labelIndex.find(label);
+        if (it != _labelIndex.end()) {
+            return it->second;
+        }
+        int labelId = static_cast<int>(_labels.size());
+        _labels.push_back(label);
+        _labelIndex.emplace(label, labelId);
+        return labelId;
+    }
+
+    void ObjectStore::pushHistory(const size_t &slot, const cv::Point2i &centroid, const int &width) {
+        auto &head = _historyHeads[slot];
+        auto &size = _historySizes[slot];
+        size_t pos;
+        if (size < _historyLength) {
+            pos = (head + size) % _historyLength;
+            size++;
+        } else {
+            pos = head;
+            head = static_cast<uint32_t>((head + 1) % _historyLength);
+        }
+        _historyCentroids[slot * _historyLength + pos] = centroid;
+        _historyWidths[slot * _historyLength + pos] = width;
+    }
+
+    void ObjectStore::setHistoryLength(const size_t &historyLength) {
+        _historyLength = std::max<size_t>(historyLength, 2);
+        _historyCentroids.assign(capacity() * _historyLength, cv::Point2i());
+        _historyWidths.assign(capacity() * _historyLength, 0);
+        std::fill(_historyHeads.begin(), _historyHeads.end(), 0);
+        std::fill(_historySizes.begin(), _historySizes.end(), 0);
+    }
+
+    size_t ObjectStore::add(const int &objID, const cv::Rect2i &bbox, const int &classId, const float &confidence,
+                            const string &label, const uint64_t &frameIndex) {
+        size_t slot;
+        if (!_freeSlots.empty()) {
+            slot = _freeSlots.back();
+            _freeSlots.pop_back();
+        } else {
+            slot = capacity();
+            _objIDs.push_back(-1);
+            _alive.push_back(0);
+            _bboxes.emplace_back();
+            _centroids.emplace_back();
+            _classIds.push_back(0);
+            _confidences.push_back(0.f);
+            _labelIds.push_back(0);
+            _speeds.push_back(0.);
+            _lastSeenFrames.push_back(0);
+            _motions.emplace_back();
+            _historyCentroids.resize(_historyCentroids.size() + _historyLength);
+            _historyWidths.resize(_historyWidths.size() + _historyLength);
+            _historyHeads.push_back(0);
+            _historySizes.push_back(0);
+        }
+        _objIDs[slot] = objID;
+        _alive[slot] = 1;
+        _classIds[slot] = classId;
+        _confidences[slot] = confidence;
+        _labelIds[slot] = internLabel(label);
+        _speeds[slot] = 0.;
+        _historyHeads[slot] = 0;
+        _historySizes[slot] = 0;
+        _motions[slot].reset(bbox);
+        _lastSeenFrames[slot] = frameIndex;
+        _size++;
+        update(slot, bbox);
+        return slot;
+    }
+
+    void ObjectStore::remove(const size_t &slot) {
+        if (!_alive[slot]) {
+            return;
+        }
+        _alive[slot] = 0;
+        _objIDs[slot] = -1;
+        _freeSlots.push_back(slot);
+        _size--;
+    }
+
+    void ObjectStore::update(const size_t &slot, const cv::Rect2i &bbox) {
+        auto centroid = cv::Point2i(bbox.x + (bbox.width / 2), bbox.y + (bbox.height / 2));
+        _bboxes[slot] = bbox;
+        _centroids[slot] = centroid;
+        pushHistory(slot, centroid, bbox.width);
+    }
+
+    void ObjectStore::markSeen(const size_t &slot, const uint64_t &frameIndex) {
+        _lastSeenFrames[slot] = std::max(_lastSeenFrames[slot], frameIndex);
+    }
+
+} // namespace detector
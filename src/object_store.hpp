@@ -0,0 +1,109 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "model.hpp"
+#include "motion_filter.hpp"
+
+namespace detector {
+
+    // Boxes of tracked objects keyed by object ID, sorted by ID. A flat vector rather than a map,
+    // so that it is refilled every frame without allocating.
+    using ObjectBboxes = vector<pair<int, cv::Rect2i>>;
+
+    // Dense table of tracked objects. Every per-object attribute lives in its own contiguous array
+    // indexed by slot, so per-frame passes (tracking, speed estimation, rendering) walk memory
+    // linearly instead of chasing map nodes. Freed slots go to a free list and are reused by the
+    // next object; object IDs themselves keep growing so logs never mix two objects up.
+    class ObjectStore {
+    private:
+
+        vector<int> _objIDs;
+        vector<uint8_t> _alive;
+        vector<cv::Rect2i> _bboxes;
+        vector<cv::Point2i> _centroids;
+        vector<int> _classIds;
+        vector<float> _confidences;
+        vector<int> _labelIds;
+        vector<double> _speeds;
+        vector<uint64_t> _lastSeenFrames;
+        vector<MotionFilter> _motions;
+
+        // Per-slot ring buffers of the last _historyLength positions, stored back to back.
+        size_t _historyLength = 2;
+        vector<cv::Point2i> _historyCentroids;
+        vector<int> _historyWidths;
+        vector<uint32_t> _historyHeads;
+        vector<uint32_t> _historySizes;
+
+        vector<size_t> _freeSlots;
+        size_t _size = 0;
+
+        // Labels are interned: there are at most (classes x confidence percents) distinct strings.
+        vector<string> _labels;
+        unordered_map<string, int> _labelIndex;
+
+        int internLabel(const string &label);
+
+        void pushHistory(const size_t &slot, const cv::Point2i &centroid, const int &width);
+
+    public:
+
+        void setHistoryLength(const size_t &historyLength);
+
+        size_t add(const int &objID, const cv::Rect2i &bbox, const int &classId, const float &confidence,
+                   const string &label, const uint64_t &frameIndex);
+
+        void remove(const size_t &slot);
+
+        void update(const size_t &slot, const cv::Rect2i &bbox);
+
+        // A detection confirmed the object on the given frame, or the detector did not look for it.
+        void markSeen(const size_t &slot, const uint64_t &frameIndex);
+
+        [[nodiscard]] size_t capacity() const { return _objIDs.size(); }
+
+        [[nodiscard]] size_t size() const { return _size; }
+
+        [[nodiscard]] bool isAlive(const size_t &slot) const { return _alive[slot]; }
+
+        [[nodiscard]] int objID(const size_t &slot) const { return _objIDs[slot]; }
+
+        [[nodiscard]] const cv::Rect2i &bbox(const size_t &slot) const { return _bboxes[slot]; }
+
+        [[nodiscard]] const cv::Point2i &centroid(const size_t &slot) const { return _centroids[slot]; }
+
+        [[nodiscard]] int classId(const size_t &slot) const { return _classIds[slot]; }
+
+        [[nodiscard]] float confidence(const size_t &slot) const { return _confidences[slot]; }
+
+        [[nodiscard]] const string &label(const size_t &slot) const { return _labels[_labelIds[slot]]; }
+
+        [[nodiscard]] double speed(const size_t &slot) const { return _speeds[slot]; }
+
+        void setSpeed(const size_t &slot, const double &speed) { _speeds[slot] = speed; }
+
+        // Frame the object was last detected on or not looked for, trackers do not count.
+        [[nodiscard]] uint64_t lastSeenFrame(const size_t &slot) const { return _lastSeenFrames[slot]; }
+
+        // Started at the box the object was added with; predicted and corrected by the tracker.
+        [[nodiscard]] MotionFilter &motion(const size_t &slot) { return _motions[slot]; }
+
+        [[nodiscard]] const MotionFilter &motion(const size_t &slot) const { return _motions[slot]; }
+
+        [[nodiscard]] size_t historySize(const size_t &slot) const { return _historySizes[slot]; }
+
+        // i = 0 is the oldest recorded position, historySize(slot) - 1 the latest one.
+        [[nodiscard]] const cv::Point2i &historyCentroid(const size_t &slot, const size_t &i) const {
+            return _historyCentroids[slot * _historyLength + (_historyHeads[slot] + i) % _historyLength];
+        }
+
+        [[nodiscard]] int historyWidth(const size_t &slot, const size_t &i) const {
+            return _historyWidths[slot * _historyLength + (_historyHeads[slot] + i) % _historyLength];
+        }
+
+    };
+
+} // namespace detector
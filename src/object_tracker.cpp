@@ -0,0 +1,226 @@
+#include "object_tracker.hpp"
+
+namespace detector {
+
+    bool parseTrackerBackend(const string &name, TrackerBackend &backend) {
+        if (name == "dlib") {
+            backend = TrackerBackend::DLIB;
+        } else if (name == "mosse") {
+            backend = TrackerBackend::MOSSE;
+        } else if (name == "iou") {
+            backend = TrackerBackend::IOU;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    bool trackerUsesImage(const TrackerBackend &backend) {
+        return backend != TrackerBackend::IOU;
+    }
+
+    DlibTracker::DlibTracker(const double &minQuality) : _minQuality(minQuality) {}
+
+    void DlibTracker::start(const cv::Mat &img, const cv::Rect2d &bbox) {
+        dlib::drectangle rect(bbox.x, bbox.y, bbox.x + bbox.width, bbox.y + bbox.height);
+        if (img.channels() == 1) {
+            _tracker.start_track(dlib::cv_image<unsigned char>(cvIplImage(img)), rect);
+        } else {
+            _tracker.start_track(dlib::cv_image<dlib::bgr_pixel>(cvIplImage(img)), rect);
+        }
+    }
+
+    bool DlibTracker::update(const cv::Mat &img) {
+        double quality;
+        if (img.channels() == 1) {
+            quality = _tracker.update(dlib::cv_image<unsigned char>(cvIplImage(img)));
+        } else {
+            quality = _tracker.update(dlib::cv_image<dlib::bgr_pixel>(cvIplImage(img)));
+        }
+        return quality >= _minQuality;
+    }
+
+    bool DlibTracker::updateWithGuess(const cv::Mat &img, const cv::Rect2d &guess) {
+        dlib::drectangle rect(guess.x, guess.y, guess.x + guess.width, guess.y + guess.height);
+        double quality;
+        if (img.channels() == 1) {
+            quality = _tracker.update(dlib::cv_image<unsigned char>(cvIplImage(img)), rect);
+        } else {
+            quality = _tracker.update(dlib::cv_image<dlib::bgr_pixel>(cvIplImage(img)), rect);
+        }
+        return quality >= _minQuality;
+    }
+
+    cv::Rect2d DlibTracker::getPosition() const {
+        auto position = _tracker.get_position();
+        return cv::Rect2d(position.left(), position.top(), position.width(), position.height());
+    }
+
+    MosseTracker::MosseTracker(const double &minQuality) : _minQuality(minQuality) {}
+
+    void MosseTracker::extractSpectrum(const cv::Mat &img) {
+        cv::getRectSubPix(img, _patchSize, cv::Point2f(float(_center.x), float(_center.y)), _patch);
+        if (_patch.channels() == 3) {
+            cv::cvtColor(_patch, _gray, cv::COLOR_BGR2GRAY);
+        } else {
+            _gray = _patch;
+        }
+        cv::resize(_gray, _resized, cv::Size2i(_windowSize, _windowSize), 0, 0, cv::INTER_AREA);
+        // log(1 + x), normalized to zero mean and unit deviation, then tapered to zero at the borders.
+        _resized.convertTo(_features, CV_32F, 1., 1.);
+        cv::log(_features, _features);
+        cv::Scalar mean, stdDev;
+        cv::meanStdDev(_features, mean, stdDev);
+        auto scale = 1. / (stdDev[0] + 1e-5);
+        _features.convertTo(_features, CV_32F, scale, -mean[0] * scale);
+        cv::multiply(_features, _window, _features);
+        cv::dft(_features, _spectrum, cv::DFT_COMPLEX_OUTPUT);
+    }
+
+    void MosseTracker::train(const double &rate) {
+        // Running averages of G * conj(F) and F * conj(F); the filter is their ratio.
+        cv::mulSpectrums(_target, _spectrum, _product, 0, true);
+        cv::addWeighted(_product, rate, _numerator, 1. - rate, 0., _numerator);
+        cv::mulSpectrums(_spectrum, _spectrum, _product, 0, true);
+        cv::addWeighted(_product, rate, _denominator, 1. - rate, 0., _denominator);
+
+        _filter.create(_numerator.rows, _numerator.cols, _numerator.type());
+        for (int y = 0; y < _filter.rows; y++) {
+            auto *numerator = _numerator.ptr<cv::Vec2f>(y);
+            auto *denominator = _denominator.ptr<cv::Vec2f>(y);
+            auto *filter = _filter.ptr<cv::Vec2f>(y);
+            for (int x = 0; x < _filter.cols; x++) {
+                // The denominator is real; the constant regularizes frequencies absent from the patch.
+                float divisor = denominator[x][0] + 1e-2f;
+                filter[x] = cv::Vec2f(numerator[x][0] / divisor, numerator[x][1] / divisor);
+            }
+        }
+    }
+
+    double MosseTracker::getPeakToSidelobeRatio(const double &peak, const cv::Point2i &peakLoc) {
+        _sidelobeMask.create(_response.rows, _response.cols, CV_8UC1);
+        _sidelobeMask.setTo(cv::Scalar(255));
+        auto peakArea = cv::Rect2i(peakLoc.x - 5, peakLoc.y - 5, 11, 11) & cv::Rect2i(0, 0, _windowSize, _windowSize);
+        _sidelobeMask(peakArea).setTo(cv::Scalar(0));
+        cv::Scalar mean, stdDev;
+        cv::meanStdDev(_response, mean, stdDev, _sidelobeMask);
+        return (peak - mean[0]) / (stdDev[0] + 1e-5);
+    }
+
+    void MosseTracker::start(const cv::Mat &img, const cv::Rect2d &bbox) {
+        _center = cv::Point2d(bbox.x + bbox.width / 2, bbox.y + bbox.height / 2);
+        _size = bbox.size();
+        // The window covers the object and as much context around it.
+        _patchSize = cv::Size2i(std::max(8, int(std::lround(2 * bbox.width))),
+                                std::max(8, int(std::lround(2 * bbox.height))));
+        cv::createHanningWindow(_window, cv::Size2i(_windowSize, _windowSize), CV_32F);
+
+        cv::Mat peak(_windowSize, _windowSize, CV_32F);
+        double sigma = 2.;
+        for (int y = 0; y < _windowSize; y++) {
+            for (int x = 0; x < _windowSize; x++) {
+                double dx = x - _windowSize / 2;
+                double dy = y - _windowSize / 2;
+                peak.at<float>(y, x) = float(std::exp(-(dx * dx + dy * dy) / (2 * sigma * sigma)));
+            }
+        }
+        cv::dft(peak, _target, cv::DFT_COMPLEX_OUTPUT);
+
+        extractSpectrum(img);
+        _numerator = cv::Mat::zeros(_spectrum.rows, _spectrum.cols, _spectrum.type());
+        _denominator = cv::Mat::zeros(_spectrum.rows, _spectrum.cols, _spectrum.type());
+        train(1.);
+    }
+
+    bool MosseTracker::update(const cv::Mat &img) {
+        extractSpectrum(img);
+        cv::mulSpectrums(_spectrum, _filter, _product, 0);
+        cv::dft(_product, _response, cv::DFT_INVERSE | cv::DFT_SCALE | cv::DFT_REAL_OUTPUT);
+
+        double peak;
+        cv::Point2i peakLoc;
+        cv::minMaxLoc(_response, nullptr, &peak, nullptr, &peakLoc);
+        if (getPeakToSidelobeRatio(peak, peakLoc) < _minQuality) {
+            return false;
+        }
+        // The response peaks at the window centre when the object has not moved.
+        _center.x += (peakLoc.x - _windowSize / 2) * double(_patchSize.width) / _windowSize;
+        _center.y += (peakLoc.y - _windowSize / 2) * double(_patchSize.height) / _windowSize;
+
+        extractSpectrum(img);
+        train(_learningRate);
+        return true;
+    }
+
+    bool MosseTracker::updateWithGuess(const cv::Mat &img, const cv::Rect2d &guess) {
+        _center = cv::Point2d(guess.x + guess.width / 2, guess.y + guess.height / 2);
+        return update(img);
+    }
+
+    cv::Rect2d MosseTracker::getPosition() const {
+        return cv::Rect2d(_center.x - _size.width / 2, _center.y - _size.height / 2, _size.width, _size.height);
+    }
+
+    KalmanIouTracker::KalmanIouTracker(const uint64_t &maxCoastFrames) : _maxCoastFrames(maxCoastFrames) {}
+
+    void KalmanIouTracker::start(const cv::Mat &img, const cv::Rect2d &bbox) {
+        // State: centre x, centre y, width, height and their velocities. Measurement: the first four.
+        _filter.init(8, 4, 0, CV_32F);
+        cv::setIdentity(_filter.transitionMatrix);
+        for (int i = 0; i < 4; i++) {
+            _filter.transitionMatrix.at<float>(i, i + 4) = 1.f;
+        }
+        cv::setIdentity(_filter.measurementMatrix);
+        cv::setIdentity(_filter.processNoiseCov, cv::Scalar(1.));
+        for (int i = 4; i < 8; i++) {
+            _filter.processNoiseCov.at<float>(i, i) = 0.01f;
+        }
+        cv::setIdentity(_filter.measurementNoiseCov, cv::Scalar(10.));
+        // Velocities are unknown until the second detection.
+        cv::setIdentity(_filter.errorCovPost, cv::Scalar(10.));
+        for (int i = 4; i < 8; i++) {
+            _filter.errorCovPost.at<float>(i, i) = 1000.f;
+        }
+        _filter.statePost.setTo(cv::Scalar(0));
+        _filter.statePost.at<float>(0) = float(bbox.x + bbox.width / 2);
+        _filter.statePost.at<float>(1) = float(bbox.y + bbox.height / 2);
+        _filter.statePost.at<float>(2) = float(bbox.width);
+        _filter.statePost.at<float>(3) = float(bbox.height);
+        _measurement.create(4, 1, CV_32F);
+        _coastFrames = 0;
+    }
+
+    bool KalmanIouTracker::update(const cv::Mat &img) {
+        _filter.predict();
+        return ++_coastFrames <= _maxCoastFrames;
+    }
+
+    void KalmanIouTracker::correct(const cv::Rect2d &bbox) {
+        _measurement.at<float>(0) = float(bbox.x + bbox.width / 2);
+        _measurement.at<float>(1) = float(bbox.y + bbox.height / 2);
+        _measurement.at<float>(2) = float(bbox.width);
+        _measurement.at<float>(3) = float(bbox.height);
+        _filter.correct(_measurement);
+        _coastFrames = 0;
+    }
+
+    cv::Rect2d KalmanIouTracker::getPosition() const {
+        auto &state = _filter.statePost;
+        double width = std::max(1.f, state.at<float>(2));
+        double height = std::max(1.f, state.at<float>(3));
+        return cv::Rect2d(state.at<float>(0) - width / 2, state.at<float>(1) - height / 2, width, height);
+    }
+
+    std::unique_ptr<ObjectTracker> createObjectTracker(const TrackerBackend &backend, const double &minQuality,
+                                                       const uint64_t &maxCoastFrames) {
+        switch (backend) {
+            case TrackerBackend::MOSSE:
+                return std::make_unique<MosseTracker>(minQuality);
+            case TrackerBackend::IOU:
+                return std::make_unique<KalmanIouTracker>(maxCoastFrames);
+            default:
+                return std::make_unique<DlibTracker>(minQuality);
+        }
+    }
+
+} // namespace detector
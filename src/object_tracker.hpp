@@ -0,0 +1,150 @@
+#pragma once
+
+#include <memory>
+
+#include <dlib/image_processing.h>
+#include <dlib/opencv/cv_image.h>
+
+#include "model.hpp"
+
+namespace detector {
+
+    enum class TrackerBackend : int {
+        DLIB = 0,
+        MOSSE,
+        IOU
+    };
+
+    bool parseTrackerBackend(const string &name, TrackerBackend &backend);
+
+    // Whether trackers of the backend look at frames at all. Those that do not are only moved by
+    // their motion model between detections, so no tracking image has to be prepared for them.
+    [[nodiscard]] bool trackerUsesImage(const TrackerBackend &backend);
+
+    // Follows a single object between detections. Images are the tracking images prepared by
+    // MultiTracker (BGR or grayscale) and boxes are in their coordinates.
+    class ObjectTracker {
+    public:
+
+        virtual ~ObjectTracker() = default;
+
+        virtual void start(const cv::Mat &img, const cv::Rect2d &bbox) = 0;
+
+        // Returns false once the object is lost.
+        virtual bool update(const cv::Mat &img) = 0;
+
+        // Same as update, searching around guess rather than the last position, for trackers that
+        // have not seen the last frames.
+        virtual bool updateWithGuess(const cv::Mat &img, const cv::Rect2d &guess) { return update(img); }
+
+        // A detection has been matched with the object.
+        virtual void correct(const cv::Rect2d &bbox) {}
+
+        [[nodiscard]] virtual cv::Rect2d getPosition() const = 0;
+
+    };
+
+    // dlib correlation tracker with scale estimation. The object is lost when the peak-to-sidelobe
+    // ratio of the correlation drops below minQuality.
+    class DlibTracker : public ObjectTracker {
+    private:
+
+        dlib::correlation_tracker _tracker;
+        double _minQuality;
+
+    public:
+
+        explicit DlibTracker(const double &minQuality);
+
+        void start(const cv::Mat &img, const cv::Rect2d &bbox) override;
+
+        bool update(const cv::Mat &img) override;
+
+        bool updateWithGuess(const cv::Mat &img, const cv::Rect2d &guess) override;
+
+        [[nodiscard]] cv::Rect2d getPosition() const override;
+
+    };
+
+    // MOSSE correlation filter (Bolme et al., 2010) over a fixed size window: a single FFT correlation
+    // per frame and no scale search, which makes it several times cheaper than the dlib tracker.
+    // The object keeps the size it was started with. Lost as the dlib tracker, on a low
+    // peak-to-sidelobe ratio.
+    class MosseTracker : public ObjectTracker {
+    private:
+
+        static constexpr int _windowSize = 64;
+        static constexpr double _learningRate = 0.125;
+
+        double _minQuality;
+        cv::Point2d _center;
+        cv::Size2d _size;
+        cv::Size2i _patchSize;
+
+        // Spectra of the desired response and of the filter's numerator and denominator.
+        cv::Mat _target;
+        cv::Mat _numerator;
+        cv::Mat _denominator;
+        cv::Mat _filter;
+
+        // Per-frame buffers, kept to reuse their memory.
+        cv::Mat _window;
+        cv::Mat _patch;
+        cv::Mat _gray;
+        cv::Mat _resized;
+        cv::Mat _features;
+        cv::Mat _spectrum;
+        cv::Mat _product;
+        cv::Mat _response;
+        cv::Mat _sidelobeMask;
+
+        void extractSpectrum(const cv::Mat &img);
+
+        void train(const double &rate);
+
+        [[nodiscard]] double getPeakToSidelobeRatio(const double &peak, const cv::Point2i &peakLoc);
+
+    public:
+
+        explicit MosseTracker(const double &minQuality);
+
+        void start(const cv::Mat &img, const cv::Rect2d &bbox) override;
+
+        bool update(const cv::Mat &img) override;
+
+        bool updateWithGuess(const cv::Mat &img, const cv::Rect2d &guess) override;
+
+        [[nodiscard]] cv::Rect2d getPosition() const override;
+
+    };
+
+    // Constant velocity Kalman filter over the box centre and size, corrected by matched detections
+    // only. Between detections the box is predicted without looking at the frame, and association
+    // by IoU keeps the identities. The object is lost after maxCoastFrames frames without detection.
+    class KalmanIouTracker : public ObjectTracker {
+    private:
+
+        cv::KalmanFilter _filter;
+        cv::Mat _measurement;
+        uint64_t _maxCoastFrames;
+        uint64_t _coastFrames = 0;
+
+    public:
+
+        explicit KalmanIouTracker(const uint64_t &maxCoastFrames);
+
+        void start(const cv::Mat &img, const cv::Rect2d &bbox) override;
+
+        bool update(const cv::Mat &img) override;
+
+        void correct(const cv::Rect2d &bbox) override;
+
+        [[nodiscard]] cv::Rect2d getPosition() const override;
+
+    };
+
+    [[nodiscard]] std::unique_ptr<ObjectTracker> createObjectTracker(const TrackerBackend &backend,
+                                                                     const double &minQuality,
+                                                                     const uint64_t &maxCoastFrames);
+
+} // namespace detector
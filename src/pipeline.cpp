@@ -0,0 +1,144 @@
+#include "pipeline.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace detector {
+
+    auto fontFace = cv::FONT_HERSHEY_SIMPLEX;
+    auto color = cv::Scalar(0, 255, 255);
+    auto fontScale = 0.5;
+    uint64_t objectCountersLogInterval = 1000;
+    size_t allocationWarmupFrames = 100;
+    // Upper bound of the first latency bucket, each next bucket's bound is 1% higher, up to 100 s.
+    double minBucketLatencyMs = 0.01;
+    double latencyBucketGrowth = 1.01;
+
+    bool parseBackpressurePolicy(const string &name, BackpressurePolicy &policy) {
+        if (name == "block") {
+            policy = BackpressurePolicy::BLOCK;
+        } else if (name == "drop") {
+            policy = BackpressurePolicy::DROP_OLDEST;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    double percentile(vector<double> samples, const double &p) {
+        if (samples.empty()) {
+            return 0.;
+        }
+        auto rank = static_cast<size_t>(p / 100. * double(samples.size() - 1) + 0.5);
+        std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+        return samples[rank];
+    }
+
+    void FrameStats::addFrame(const double &latencyMs) {
+        size_t bucket = 0;
+        if (latencyMs > minBucketLatencyMs) {
+            bucket = static_cast<size_t>(std::ceil(std::log(latencyMs / minBucketLatencyMs) /
+                                                   std::log(latencyBucketGrowth)));
+        }
+        _latencyBuckets[std::min(bucket, _nLatencyBuckets - 1)]++;
+        _minLatency = _frameCount ? std::min(_minLatency, latencyMs) : latencyMs;
+        _maxLatency = _frameCount ? std::max(_maxLatency, latencyMs) : latencyMs;
+        _latencySum += latencyMs;
+        _frameCount++;
+        _lastFrameTime = std::chrono::steady_clock::now();
+    }
+
+    void FrameStats::addAllocations(const uint64_t &count) {
+        if (_frameCount < allocationWarmupFrames) {
+            return;
+        }
+        _allocations += count;
+        _maxFrameAllocations = std::max(_maxFrameAllocations, count);
+        _allocatingFrames += count > 0;
+    }
+
+    double FrameStats::percentile(const double &p) const {
+        if (_frameCount == 0) {
+            return 0.;
+        }
+        // Same nearest rank as detector::percentile, answered with the upper bound of its bucket.
+        auto rank = static_cast<uint64_t>(p / 100. * double(_frameCount - 1) + 0.5);
+        uint64_t count = 0;
+        size_t bucket = 0;
+        for (; bucket < _nLatencyBuckets - 1; bucket++) {
+            count += _latencyBuckets[bucket];
+            if (count > rank) {
+                break;
+            }
+        }
+        auto bound = minBucketLatencyMs * std::pow(latencyBucketGrowth, double(bucket));
+        return std::clamp(bound, _minLatency, _maxLatency);
+    }
+
+    double FrameStats::getWallTime() const {
+        return std::chrono::duration<double>(_lastFrameTime - _startTime).count();
+    }
+
+    double FrameStats::getThroughput() const {
+        auto wallTime = getWallTime();
+        return wallTime > 0 ? double(getFrameCount()) / wallTime : 0.;
+    }
+
+    void FrameStats::report() const {
+        auto frames = _frameCount;
+        auto mean = frames ? _latencySum / double(frames) : 0.;
+        std::clog << "Processed " << frames << " frames in " << getWallTime() << " s ("
+                  << getThroughput() << " FPS)" << std::endl;
+        std::clog << "Frame latency, ms: avg " << mean << ", p50 " << percentile(50) << ", p95 " << percentile(95)
+                  << ", p99 " << percentile(99) << std::endl;
+        if (allocationsCounted() && frames > allocationWarmupFrames) {
+            std::clog << "Heap allocations after " << allocationWarmupFrames << " warm-up frames: " << _allocations
+                      << " (max " << _maxFrameAllocations << " per frame, " << _allocatingFrames
+                      << " frames allocating)" << std::endl;
+        }
+    }
+
+    void logObjectCounters(const MultiTracker &multiTracker, const uint64_t &seq) {
+        if (!(seq % objectCountersLogInterval)) {
+            auto counters = multiTracker.getObjectCounters();
+            std::clog << "Objects: " << counters.live << " live, " << counters.retired << " retired, "
+                      << counters.slots << " slots allocated" << std::endl;
+        }
+    }
+
+    void collectOverlays(const MultiTracker &multiTracker, FramePacket &packet) {
+        packet.overlays.clear();
+        multiTracker.forEachObject([&](const TrackedObjectView &obj) {
+            ObjectOverlay overlay{obj.bbox, {}, static_cast<int>(obj.speed)};
+            auto length = obj.label.copy(overlay.label.data(), overlay.label.size() - 1);
+            overlay.label[length] = '\0';
+            packet.overlays.push_back(overlay);
+        });
+    }
+
+    void renderFrame(FramePacket &packet) {
+        // putText wants a string: format into one per thread that keeps its capacity between frames.
+        static thread_local string text;
+        char buffer[64];
+        auto putText = [&](const cv::Point2i &org) {
+            text.assign(buffer);
+            cv::putText(packet.frame, text, org, fontFace, fontScale, color);
+        };
+
+        std::snprintf(buffer, sizeof(buffer), "FPS: %f", packet.fps);
+        putText(cv::Point2i(15, 15));
+        for (auto &overlay: packet.overlays) {
+            auto &bbox = overlay.bbox;
+            cv::rectangle(packet.frame, bbox, color, 2);
+            // Speeds of objects outside measurement zones are negative.
+            if (overlay.speed >= 0) {
+                std::snprintf(buffer, sizeof(buffer), "%d km/h", overlay.speed);
+                putText(cv::Point2i(bbox.x, bbox.y - 18));
+            }
+            std::snprintf(buffer, sizeof(buffer), "%s", overlay.label.data());
+            putText(cv::Point2i(bbox.x, bbox.y - 5));
+        }
+    }
+
+} // namespace detector
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+#include "alloc_counter.hpp"
+#include "capture.hpp"
+#include "multitracker.hpp"
+
+namespace detector {
+
+    using std::deque;
+
+    enum class BackpressurePolicy : int {
+        BLOCK = 0,
+        DROP_OLDEST
+    };
+
+    bool parseBackpressurePolicy(const string &name, BackpressurePolicy &policy);
+
+    // Plain data only: overlays are collected for every object on every frame, so they must not allocate.
+    struct ObjectOverlay {
+        cv::Rect2i bbox;
+        std::array<char, 32> label;
+        int speed;
+    };
+
+    struct FramePacket {
+        uint64_t seq{};
+        std::chrono::steady_clock::time_point captureTime;
+        cv::Mat frame;
+        // Keeps a pooled frame buffer out of the pool while the packet is alive, empty otherwise.
+        std::shared_ptr<void> buffer;
+        double fps{};
+        vector<ObjectOverlay> overlays;
+    };
+
+    // Collects per-frame latencies of a run and prints throughput and latency percentiles at its end.
+    // Latencies are counted in buckets 1% wide, so that a live stream running for days keeps the same
+    // few kilobytes and percentiles stay within 1% of their exact value.
+    class FrameStats {
+    private:
+
+        static constexpr size_t _nLatencyBuckets = 1622;
+
+        std::chrono::steady_clock::time_point _startTime = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point _lastFrameTime = _startTime;
+        std::array<uint64_t, _nLatencyBuckets> _latencyBuckets{};
+        uint64_t _frameCount = 0;
+        double _latencySum = 0.;
+        double _minLatency = 0.;
+        double _maxLatency = 0.;
+
+        uint64_t _allocations = 0;
+        uint64_t _maxFrameAllocations = 0;
+        uint64_t _allocatingFrames = 0;
+
+    public:
+
+        void addFrame(const double &latencyMs);
+
+        // Heap allocations made while processing the next frame. The first frames warm buffers up
+        // and are not counted.
+        void addAllocations(const uint64_t &count);
+
+        [[nodiscard]] double percentile(const double &p) const;
+
+        [[nodiscard]] size_t getFrameCount() const { return _frameCount; }
+
+        // Seconds from the start of processing until the last frame was done.
+        [[nodiscard]] double getWallTime() const;
+
+        [[nodiscard]] double getThroughput() const;
+
+        void report() const;
+
+    };
+
+    // Nearest-rank percentile (p in [0, 100]) of a set of samples, 0 for an empty set.
+    [[nodiscard]] double percentile(vector<double> samples, const double &p);
+
+    void logObjectCounters(const MultiTracker &multiTracker, const uint64_t &seq);
+
+    void collectOverlays(const MultiTracker &multiTracker, FramePacket &packet);
+
+    void renderFrame(FramePacket &packet);
+
+    // Fixed-capacity FIFO between two pipeline stages. A full queue either blocks the producer
+    // or evicts its oldest element, depending on the policy. close() wakes up every waiter:
+    // push() fails from then on and pop() drains what is left before failing.
+    template<class T>
+    class BoundedQueue {
+    private:
+
+        deque<T> _items;
+        size_t _capacity;
+        BackpressurePolicy _policy;
+        bool _closed = false;
+        uint64_t _dropped = 0;
+
+        mutable std::mutex _mutex;
+        std::condition_variable _notEmpty;
+        std::condition_variable _notFull;
+
+    public:
+
+        BoundedQueue(const size_t &capacity, const BackpressurePolicy &policy) :
+                _capacity(capacity > 0 ? capacity : 1), _policy(policy) {}
+
+        bool push(T item) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (_policy == BackpressurePolicy::BLOCK) {
+                _notFull.wait(lock, [this] { return _closed || _items.size() < _capacity; });
+            }
+            // Items left in a closed queue are still drained by pop(), none of them may be evicted.
+            if (_closed) {
+                return false;
+            }
+            if (_items.size() >= _capacity) {
+                _items.pop_front();
+                _dropped++;
+            }
+            _items.push_back(std::move(item));
+            lock.unlock();
+            _notEmpty.notify_one();
+            return true;
+        }
+
+        bool pop(T &item) {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _notEmpty.wait(lock, [this] { return _closed || !_items.empty(); });
+            if (_items.empty()) {
+                return false;
+            }
+            item = std::move(_items.front());
+            _items.pop_front();
+            lock.unlock();
+            _notFull.notify_one();
+            return true;
+        }
+
+        void close() {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                _closed = true;
+            }
+            _notEmpty.notify_all();
+            _notFull.notify_all();
+        }
+
+        [[nodiscard]] uint64_t dropped() const {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _dropped;
+        }
+
+    };
+
+} // namespace detector
@@ -4,123 +4,321 @@ namespace detector {
 
     using namespace std::chrono;
 
-    auto fontFace = cv::FONT_HERSHEY_SIMPLEX;
-    auto color = cv::Scalar(0, 255, 255);
-    auto fontScale = 0.5;
-    double dlibMinTrackingQuality = 7.;
+    bool VideoProcessor::processFrame(cv::Mat &frame, int &frameCounter) {
+        auto startTime = steady_clock::now();
+        if (!readFrame(frame)) {
+            return false;
+        }
+        // The packet is reused from frame to frame so that its overlays keep their capacity.
+        _packet.seq = frameCounter;
+        _packet.captureTime = startTime;
+        _packet.frame = frame;
+
+        trackFrame(_packet, startTime);
+        {
+            ScopedStageTimer overlayTimer(_metrics, Stage::OVERLAY);
+            renderFrame(_packet);
+        }
 
+        frameCounter++;
+        return true;
+    }
 
-    void VideoProcessor::processFrame(cv::Mat &frame, int &frameCounter) {
-        auto startTime = system_clock::now();
-        bool bSuccess = _cap.read(frame);
-        if (!bSuccess) {
-            std::cerr << "Cannot read a frame from video file" << std::endl;
-            return;
+    bool VideoProcessor::readFrame(cv::Mat &frame) {
+        ScopedStageTimer decodeTimer(_metrics, Stage::DECODE);
+        if (!_cap.read(frame)) {
+            std::clog << "No more frames in video source" << std::endl;
+            return false;
         }
-        dlib::cv_image<dlib::bgr_pixel> img(cvIplImage(frame));
+        return true;
+    }
 
-        _multiTracker.update(img);
-        if (!(frameCounter % 10)) {
-            auto detectedObjects = _net.detectObjects(frame, _classesSet, _confCoefficient);
-            _multiTracker.addTrackers(img, detectedObjects);
+    void VideoProcessor::writeFrame(cv::VideoWriter &writer, const cv::Mat &frame) {
+        if (writer.isOpened()) {
+            ScopedStageTimer encodeTimer(_metrics, Stage::ENCODE);
+            writer.write(frame);
         }
+    }
 
-        auto endTime = system_clock::now();
-        auto duration = duration_cast<milliseconds>(endTime - startTime).count();
-        auto fps = 1000. / duration;
-        cv::putText(frame, "FPS: " + std::to_string(fps), cv::Point2i(15, 15),
-                    fontFace, fontScale, color);
-        auto objSpeed = _multiTracker.getObjectsSpeed(fps);
+    void VideoProcessor::recordFrame(const double &latencyMs) {
+        _frameStats.addFrame(latencyMs);
+        if (_metrics) {
+            _metrics->addFrame(latencyMs);
+        }
+    }
 
-        for (auto &[objID, tracker]: _multiTracker.getTrackers()) {
-            auto bbox = MultiTracker::getObjectBbox(tracker);
-            auto speed = static_cast<int>(objSpeed[objID]);
-            string label = std::to_string(speed) + " km/h";
-            cv::rectangle(frame, bbox, color, 2);
-            cv::putText(frame, label, cv::Point2i(bbox.x, bbox.y - 18),
-                        fontFace, fontScale, color);
-            cv::putText(frame, _multiTracker.getLabel(objID), cv::Point2i(bbox.x, bbox.y - 5),
-                        fontFace, fontScale, color);
+    void VideoProcessor::trackFrame(FramePacket &packet, const steady_clock::time_point &startTime) {
+        {
+            ScopedStageTimer trackTimer(_metrics, Stage::TRACK);
+            _multiTracker.update(packet.frame);
+            if (_gatedOut) {
+                _multiTracker.holdObjects();
+            }
+        }
+        if (_detectionSource) {
+            if (packet.seq % _detectInterval == 0) {
+                _detectionSource(packet.seq, _detectionJob.detectedObjects);
+                _multiTracker.addTrackers(packet.frame, _detectionJob.detectedObjects);
+            }
+        } else if (_detectorWorker->poll(_detectionJob)) {
+            _multiTracker.addTrackers(_detectionJob.frame, packet.frame, _detectionJob.detectedObjects,
+                                      _detectionJob.trackedBboxes, packet.seq - _detectionJob.seq,
+                                      _detectionJob.roi);
+        }
+        // Hand the next frame to the detector as soon as it is idle, so detection runs as often
+        // as the network keeps up without ever stalling the tracking loop.
+        if (!_detectionSource && packet.seq >= _nextDetectionSeq && _detectorWorker->isIdle()) {
+            auto &roi = _multiTracker.getRoiMask().getDetectionRoi();
+            if (_useMotionGate && !_motionGate.check(packet.frame, roi, _gateRoi)) {
+                // Nothing moved since the last detection, the next chance comes after the usual interval.
+                _nextDetectionSeq = packet.seq + _detectInterval;
+                _gatedOut = true;
+            } else {
+                _multiTracker.getObjectBboxes(_trackedBboxes);
+                if (_detectorWorker->trySubmit(packet.seq, packet.frame, _trackedBboxes,
+                                               _useMotionGate ? _gateRoi : roi,
+                                               _multiTracker.getRoiMask().getTileBand())) {
+                    _nextDetectionSeq = packet.seq + _detectInterval;
+                    _gatedOut = false;
+                    _motionGate.commit();
+                }
+            }
         }
 
-        frameCounter++;
+        auto endTime = steady_clock::now();
+        auto duration = duration_cast<microseconds>(endTime - startTime).count();
+        packet.fps = 1000000. / std::max<long>(duration, 1);
+        _frameRate.addFrame(packet.captureTime);
+        _multiTracker.updateSpeeds(_frameRate.get());
+        if (_eventWriter) {
+            _eventWriter->record(_multiTracker, 0, packet.seq);
+        }
+
+        logObjectCounters(_multiTracker, packet.seq);
+        if (_metrics) {
+            auto counters = _multiTracker.getObjectCounters();
+            _metrics->setObjectCounts(counters.live, counters.retired, counters.slots);
+        }
+        collectOverlays(_multiTracker, packet);
+        if (packet.seq == 0) {
+            std::clog << "First frame tracked "
+                      << std::chrono::duration<double, std::milli>(endTime - _createdTime).count()
+                      << " ms after startup" << std::endl;
+        }
     }
 
-    void VideoProcessor::process() {
+    void VideoProcessor::process(const string &outFileName) {
+        cv::VideoWriter writer;
+        if (!outFileName.empty()) {
+            writer.open(outFileName, cv::VideoWriter::fourcc('D', 'I', 'V', '3'), 15, _frameSize, true);
+        }
         cv::Mat frame;
         int frameCounter = 0;
 
         cv::namedWindow("Video tracker", cv::WINDOW_AUTOSIZE);
-        do {
-            processFrame(frame, frameCounter);
+        _frameStats = FrameStats();
+        while (true) {
+            auto startTime = steady_clock::now();
+            if (!processFrame(frame, frameCounter)) {
+                break;
+            }
+            writeFrame(writer, frame);
+            recordFrame(duration<double, std::milli>(steady_clock::now() - startTime).count());
             cv::imshow("Video tracker", frame);
-        } while (cv::waitKey(30) != 27);
-
-        std::clog << "Esc key is pressed by user. Bye!" << std::endl;
+            if (cv::waitKey(30) == 27) {
+                std::clog << "Esc key is pressed by user. Bye!" << std::endl;
+                break;
+            }
+        }
         cv::destroyAllWindows();
+        writer.release();
+        _motionGate.report("Motion gate");
     }
 
-    void VideoProcessor::processToFile(const string &outFileName, const bool &displayNamedWindow) {
-        int fps = 15;
-        cv::VideoWriter writer(outFileName,
-                               cv::VideoWriter::fourcc('D', 'I', 'V', '3'),
-                               fps,
-                               _frameSize,
-                               true);
+    void VideoProcessor::processHeadless(const string &outFileName) {
+        // Nothing to display, so there is no reason to wait for HighGUI: frames are processed as fast
+        // as possible and the loop ends with the video source.
+        cv::VideoWriter writer;
+        if (!outFileName.empty()) {
+            writer.open(outFileName, cv::VideoWriter::fourcc('D', 'I', 'V', '3'), 15, _frameSize, true);
+        }
         cv::Mat frame;
         int frameCounter = 0;
+        _frameStats = FrameStats();
+        while (true) {
+            auto startTime = steady_clock::now();
+            auto allocations = getThreadAllocations();
+            if (!processFrame(frame, frameCounter)) {
+                break;
+            }
+            writeFrame(writer, frame);
+            _frameStats.addAllocations(getThreadAllocations() - allocations);
+            recordFrame(duration<double, std::milli>(steady_clock::now() - startTime).count());
+        }
+        writer.release();
+        _frameStats.report();
+        _motionGate.report("Motion gate");
+    }
+
+    void VideoProcessor::processPipelined(const string &outFileName, const bool &displayNamedWindow) {
+        // Stages: capture -> track -> render -> encode/display, with detection running beside the tracking
+        // stage on the DetectorWorker thread. Capture, tracking and rendering run on their own threads,
+        // encoding stays on the main thread because HighGUI is not thread-safe.
+        // Every stage has exactly one consumer and queues are FIFO, so packets leave the pipeline
+        // in capture order; dropped packets only leave gaps in the sequence.
+        // Every queue may be full while each stage holds one more packet, with the default size capture
+        // never waits for a buffer; a smaller pool throttles capture instead.
+        auto frameBuffers = _captureOptions.frameBuffers ? _captureOptions.frameBuffers : 3 * _queueDepth + 4;
+        FramePool framePool(frameBuffers, _frameSize, CV_8UC3);
+        BoundedQueue<FramePacket> capturedQueue(_queueDepth, _backpressurePolicy);
+        BoundedQueue<FramePacket> trackedQueue(_queueDepth, _backpressurePolicy);
+        BoundedQueue<FramePacket> renderedQueue(_queueDepth, _backpressurePolicy);
+        std::atomic<bool> stopped(false);
+
+        thread captureThread([&] {
+            uint64_t seq = 0;
+            while (!stopped) {
+                FramePacket packet;
+                if (!framePool.acquire(packet.frame, packet.buffer)) {
+                    break;
+                }
+                packet.captureTime = steady_clock::now();
+                if (!readFrame(packet.frame)) {
+                    break;
+                }
+                packet.seq = seq++;
+                if (!capturedQueue.push(std::move(packet))) {
+                    break;
+                }
+            }
+            capturedQueue.close();
+        });
+        thread trackThread([&] {
+            FramePacket packet;
+            while (capturedQueue.pop(packet)) {
+                // The overlay FPS is the track stage's own rate, not counting the time the packet queued.
+                trackFrame(packet, steady_clock::now());
+                if (!trackedQueue.push(std::move(packet))) {
+                    break;
+                }
+            }
+            trackedQueue.close();
+        });
+        thread renderThread([&] {
+            FramePacket packet;
+            while (trackedQueue.pop(packet)) {
+                ScopedStageTimer overlayTimer(_metrics, Stage::OVERLAY);
+                renderFrame(packet);
+                if (!renderedQueue.push(std::move(packet))) {
+                    break;
+                }
+            }
+            renderedQueue.close();
+        });
+
+        cv::VideoWriter writer;
+        if (!outFileName.empty()) {
+            writer.open(outFileName, cv::VideoWriter::fourcc('D', 'I', 'V', '3'), 15, _frameSize, true);
+        }
         if (displayNamedWindow) {
             cv::namedWindow("Video tracker", cv::WINDOW_AUTOSIZE);
-            do {
-                processFrame(frame, frameCounter);
-                writer.write(frame);
-                cv::imshow("Video tracker", frame);
-            } while (cv::waitKey(30) != 27);
+        }
+        FramePacket packet;
+        uint64_t lastDropped = 0;
+        _frameStats = FrameStats();
+        while (renderedQueue.pop(packet)) {
+            writeFrame(writer, packet.frame);
+            if (displayNamedWindow) {
+                cv::imshow("Video tracker", packet.frame);
+                if (cv::waitKey(1) == 27) {
+                    std::clog << "Esc key is pressed by user. Bye!" << std::endl;
+                    break;
+                }
+            }
+            // Latency here is end-to-end: from capture until the frame left the pipeline.
+            recordFrame(duration<double, std::milli>(steady_clock::now() - packet.captureTime).count());
+            if (_metrics) {
+                auto dropped = capturedQueue.dropped() + trackedQueue.dropped() + renderedQueue.dropped();
+                _metrics->addDroppedFrames(dropped - lastDropped);
+                lastDropped = dropped;
+            }
+        }
+
+        stopped = true;
+        framePool.close();
+        capturedQueue.close();
+        trackedQueue.close();
+        renderedQueue.close();
+        captureThread.join();
+        trackThread.join();
+        renderThread.join();
+
+        auto dropped = capturedQueue.dropped() + trackedQueue.dropped() + renderedQueue.dropped();
+        if (_metrics) {
+            _metrics->addDroppedFrames(dropped - lastDropped);
+        }
+        std::clog << "Pipeline finished: " << dropped << " frames dropped by backpressure" << std::endl;
+        _frameStats.report();
+        _motionGate.report("Motion gate");
+        if (displayNamedWindow) {
             cv::destroyAllWindows();
-        } else {
-            do {
-                processFrame(frame, frameCounter);
-                writer.write(frame);
-            } while (cv::waitKey(30) != 27);
         }
-        std::clog << "Esc key is pressed by user. Bye!" << std::endl;
         writer.release();
     }
 
-    VideoProcessor::VideoProcessor() : _multiTracker(MultiTracker(dlibMinTrackingQuality)) {}
+    VideoProcessor::VideoProcessor() : _multiTracker(MultiTracker(minTrackingQuality)) {}
 
-    void VideoProcessor::loadModel(const string &modelPath, const set<int> &classesSet, const float &confCoefficient) {
-        try {
-            _net.loadModel(modelPath);
-            std::clog << "Loaded MobileNetSSD model" << std::endl;
-            _classesSet = classesSet;
-            _confCoefficient = confCoefficient;
-        } catch (std::exception &e) {
-            std::cerr << "Error on loading MobileNetSSD model: " << e.what() << std::endl;
-            exit(-1);
-        }
+    void VideoProcessor::setRoiConfig(const string &fileName) {
+        _roiConfigFileName = fileName;
     }
 
     void VideoProcessor::openVideoSrc(const string &videoSrc) {
-        _cap.open(videoSrc);
-        if (!_cap.isOpened()) {
+        auto startTime = steady_clock::now();
+        if (!openCapture(_cap, videoSrc, _captureOptions)) {
             std::cerr << "Cannot open the video file" << std::endl;
             exit(-1);
         }
-        std::clog << "Opened video source: " << videoSrc << std::endl;
+        std::clog << "Opened video source: " << videoSrc << " in "
+                  << duration<double, std::milli>(steady_clock::now() - startTime).count() << " ms" << std::endl;
         double _dWidth = _cap.get(cv::CAP_PROP_FRAME_WIDTH);
         double _dHeight = _cap.get(cv::CAP_PROP_FRAME_HEIGHT);
         std::clog << "Frame size : " << _dWidth << " x " << _dHeight << std::endl;
         _frameSize = cv::Size2i(_dWidth, _dHeight);
+        _frameRate.reset(_cap);
+        configureSource(_multiTracker, _motionGate, _roiConfigFileName, _frameSize);
+        warmUpModel(_net.getInputCount(_frameSize, _multiTracker.getRoiMask().getTileBand()));
+    }
+
+    void VideoProcessor::setDetectionSource(DetectionSource detectionSource) {
+        _detectionSource = std::move(detectionSource);
+    }
+
+    void VideoProcessor::setMetrics(Metrics *metrics) {
+        _metrics = metrics;
+        _multiTracker.setMetrics(metrics);
+        _motionGate.setMetrics(metrics);
+        if (_detectorWorker) {
+            _detectorWorker->setMetrics(metrics);
+        }
+    }
+
+    const FrameStats &VideoProcessor::getFrameStats() const {
+        return _frameStats;
+    }
+
+    void VideoProcessor::enablePipeline(const size_t &queueDepth, const BackpressurePolicy &policy) {
+        _usePipeline = true;
+        _queueDepth = queueDepth;
+        _backpressurePolicy = policy;
     }
 
     void VideoProcessor::run(const string &outFileName, const bool &displayNamedWindow) {
-        if (!displayNamedWindow && !outFileName.empty()) {
-            processToFile(outFileName, !displayNamedWindow);
-        } else if (!outFileName.empty()) {
-            processToFile(outFileName, displayNamedWindow);
+        if (_usePipeline) {
+            processPipelined(outFileName, displayNamedWindow);
+        } else if (!displayNamedWindow) {
+            processHeadless(outFileName);
         } else {
-            process();
+            process(outFileName);
         }
     }
 
@@ -1,39 +1,79 @@
-#include <chrono>
+#pragma once
 
-#include "db.hpp"
+#include <atomic>
+#include <functional>
+
+#include "processor_base.hpp"
 
 namespace detector {
 
-    using namespace std::chrono;
+    // Fills the detections of a frame in place of the model, e.g. with the ground truth of a synthetic clip.
+    using DetectionSource = std::function<void(const uint64_t &seq, vector<DetectionResult> &detectedObjects)>;
 
-    class VideoProcessor {
+    class VideoProcessor : public ProcessorBase {
     private:
 
         cv::VideoCapture _cap;
         cv::Size2i _frameSize;
+        SourceFrameRate _frameRate;
+        string _roiConfigFileName;
 
-        MobileNetSSD _net;
-        set<int> _classesSet;
-        float _confCoefficient{};
+        DetectionJob _detectionJob;
+        ObjectBboxes _trackedBboxes;
+        uint64_t _nextDetectionSeq = 0;
+        DetectionSource _detectionSource;
+        MotionGate _motionGate;
+        cv::Rect2i _gateRoi;
+        // The motion gate skipped the last detection, objects do not age until the next one is submitted.
+        bool _gatedOut = false;
 
         MultiTracker _multiTracker;
+        FramePacket _packet;
+
+        FrameStats _frameStats;
+
+        bool _usePipeline = false;
+        size_t _queueDepth = 4;
+        BackpressurePolicy _backpressurePolicy = BackpressurePolicy::BLOCK;
+
+        bool processFrame(cv::Mat &frame, int &frameCounter);
+
+        bool readFrame(cv::Mat &frame);
+
+        void writeFrame(cv::VideoWriter &writer, const cv::Mat &frame);
+
+        void trackFrame(FramePacket &packet, const steady_clock::time_point &startTime);
+
+        void recordFrame(const double &latencyMs);
 
-        void processFrame(cv::Mat &frame, int &frameCounter);
+        void process(const string &outFileName);
 
-        void process();
+        void processHeadless(const string &outFileName);
 
-        void processToFile(const string &outFileName, const bool &displayNamedWindow);
+        void processPipelined(const string &outFileName, const bool &displayNamedWindow);
 
     public:
 
         explicit VideoProcessor();
 
-        void loadModel(const string &modelPath, const set<int> &classesSet, const float &confCoefficient);
+        // Must be set before the video source is opened, the masks are built for its frame size.
+        void setRoiConfig(const string &fileName);
 
         void openVideoSrc(const string &videoSrc);
-        
+
+        // Frames are then detected by the source on the tracking thread every detection interval instead
+        // of by the model in background, which makes runs reproducible frame for frame.
+        void setDetectionSource(DetectionSource detectionSource);
+
+        // Metrics are attached after loadModel so that the detector reports into them too.
+        void setMetrics(Metrics *metrics);
+
+        [[nodiscard]] const FrameStats &getFrameStats() const;
+
+        void enablePipeline(const size_t &queueDepth, const BackpressurePolicy &policy);
+
         void run(const string &outFileName, const bool &displayNamedWindow);
-        
+
     };
-    
+
 } // namespace detector
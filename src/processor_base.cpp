@@ -0,0 +1,113 @@
+#include "processor_base.hpp"
+
+namespace detector {
+
+    void ProcessorBase::configureSource(MultiTracker &multiTracker, MotionGate &motionGate,
+                                        const string &roiConfigFileName, const cv::Size2i &frameSize) const {
+        multiTracker.setThreadPool(_threadPool);
+        multiTracker.setTrackingScale(_trackingScale);
+        multiTracker.setTrackerBackend(_trackerBackend);
+        multiTracker.setMotionModel(_speedEstimator, _trackerSkip);
+        multiTracker.setHistoryLimits(_historyLength, _ttlFrames);
+        multiTracker.setAssociation(_associationMethod, _minIou);
+        multiTracker.setMetrics(_metrics);
+        motionGate.setThreshold(_motionThreshold);
+        motionGate.setMetrics(_metrics);
+        if (!roiConfigFileName.empty()) {
+            RoiMask roiMask;
+            roiMask.build(loadRoiConfig(roiConfigFileName), frameSize);
+            multiTracker.setRoiMask(roiMask);
+            std::clog << "Loaded ROI config: " << roiConfigFileName << std::endl;
+        }
+    }
+
+    void ProcessorBase::warmUpModel(const int &batchSize) {
+        if (!_detectorWorker) {
+            return;
+        }
+        try {
+            _net.warmUp(batchSize);
+        } catch (std::exception &e) {
+            std::cerr << "Error on warming up MobileNetSSD model: " << e.what() << std::endl;
+            exit(-1);
+        }
+        std::clog << "Warmed up MobileNetSSD model on a batch of " << batchSize << " inputs in "
+                  << _net.getStartup().warmUpMs << " ms" << std::endl;
+    }
+
+    void ProcessorBase::loadModel(const string &modelPath, const set<int> &classesSet, const float &confCoefficient) {
+        try {
+            _net.loadModel(modelPath);
+            auto &startup = _net.getStartup();
+            std::clog << "Loaded MobileNetSSD model: read in " << startup.readMs << " ms, backend set up in "
+                      << startup.setupMs << " ms" << std::endl;
+            _classesSet = classesSet;
+            _confCoefficient = confCoefficient;
+            _detectorWorker = std::make_unique<DetectorWorker>(_net, _classesSet, _confCoefficient);
+        } catch (std::exception &e) {
+            std::cerr << "Error on loading MobileNetSSD model: " << e.what() << std::endl;
+            exit(-1);
+        }
+    }
+
+    void ProcessorBase::setInferenceOptions(const InferenceOptions &options) {
+        _net.setInferenceOptions(options);
+    }
+
+    void ProcessorBase::setModelInputSize(const cv::Size2i &inputSize, const bool &letterbox) {
+        _net.setInputSize(inputSize, letterbox);
+    }
+
+    void ProcessorBase::setTiling(const TilingOptions &tiling) {
+        _net.setTiling(tiling);
+    }
+
+    void ProcessorBase::setDetectInterval(const int &detectInterval) {
+        _detectInterval = detectInterval;
+    }
+
+    void ProcessorBase::setCaptureOptions(const CaptureOptions &options) {
+        _captureOptions = options;
+    }
+
+    void ProcessorBase::setTrackerThreads(const size_t &nThreads) {
+        _threadPool = std::make_shared<ThreadPool>(nThreads);
+    }
+
+    void ProcessorBase::setTrackingScale(const double &trackingScale) {
+        _trackingScale = trackingScale;
+    }
+
+    void ProcessorBase::setMotionGate(const bool &enabled, const int &threshold) {
+        _useMotionGate = enabled;
+        _motionThreshold = threshold;
+    }
+
+    void ProcessorBase::setTrackerBackend(const TrackerBackend &backend) {
+        _trackerBackend = backend;
+    }
+
+    void ProcessorBase::setMotionModel(const SpeedEstimator &speedEstimator, const size_t &trackerSkip) {
+        _speedEstimator = speedEstimator;
+        _trackerSkip = trackerSkip;
+    }
+
+    void ProcessorBase::setHistoryLimits(const size_t &historyLength, const uint64_t &ttlFrames) {
+        _historyLength = historyLength;
+        _ttlFrames = ttlFrames;
+    }
+
+    void ProcessorBase::setAssociation(const AssociationMethod &method, const double &minIou) {
+        _associationMethod = method;
+        _minIou = minIou;
+    }
+
+    void ProcessorBase::setEventWriter(EventWriter *eventWriter) {
+        _eventWriter = eventWriter;
+    }
+
+    const ModelStartup &ProcessorBase::getModelStartup() const {
+        return _net.getStartup();
+    }
+
+} // namespace detector
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+
+#include "db.hpp"
+#include "detector_worker.hpp"
+#include "motion_gate.hpp"
+#include "pipeline.hpp"
+
+namespace detector {
+
+    using namespace std::chrono;
+
+    // Model and settings shared by VideoProcessor and MultiStreamProcessor. Tracker settings are kept
+    // until the video sources are opened and applied to the tracker of every source then.
+    class ProcessorBase {
+    protected:
+
+        MobileNetSSD _net;
+        set<int> _classesSet;
+        float _confCoefficient{};
+        std::unique_ptr<DetectorWorker> _detectorWorker;
+        int _detectInterval = 1;
+
+        CaptureOptions _captureOptions;
+        // Sources are tracked one after another, so they can all share one pool.
+        std::shared_ptr<ThreadPool> _threadPool = std::make_shared<ThreadPool>(1);
+        double _trackingScale = 1.;
+        bool _useMotionGate = false;
+        int _motionThreshold = 25;
+        TrackerBackend _trackerBackend = TrackerBackend::DLIB;
+        SpeedEstimator _speedEstimator = SpeedEstimator::KALMAN;
+        size_t _trackerSkip = 1;
+        size_t _historyLength = 2;
+        uint64_t _ttlFrames = 30;
+        AssociationMethod _associationMethod = AssociationMethod::GREEDY;
+        double _minIou = 0.3;
+
+        Metrics *_metrics = nullptr;
+        EventWriter *_eventWriter = nullptr;
+
+        // Startup is measured from the construction of the processor until the first frame is tracked.
+        steady_clock::time_point _createdTime = steady_clock::now();
+
+        // Applies the settings to the tracker and the motion gate of a source, and gives the tracker
+        // the masks of the source's ROI config, if any, built for its frame size.
+        void configureSource(MultiTracker &multiTracker, MotionGate &motionGate, const string &roiConfigFileName,
+                             const cv::Size2i &frameSize) const;
+
+        // Warms the model up, once loaded, with the batch of a detection of every source, tiles included.
+        void warmUpModel(const int &batchSize);
+
+    public:
+
+        // Peak-to-sidelobe ratio below which correlation trackers report their object as lost.
+        static constexpr double minTrackingQuality = 7.;
+
+        void loadModel(const string &modelPath, const set<int> &classesSet, const float &confCoefficient);
+
+        // Must be set before the model is loaded.
+        void setInferenceOptions(const InferenceOptions &options);
+
+        // The model is warmed up with the batch the sources are detected with, so the input size and the
+        // tiling must be set before the video sources are opened.
+        void setModelInputSize(const cv::Size2i &inputSize, const bool &letterbox);
+
+        void setTiling(const TilingOptions &tiling);
+
+        void setDetectInterval(const int &detectInterval);
+
+        // The settings below must be set before the video sources are opened.
+        void setCaptureOptions(const CaptureOptions &options);
+
+        void setTrackerThreads(const size_t &nThreads);
+
+        void setTrackingScale(const double &trackingScale);
+
+        // Skips detections of frames without motion and restricts the others to the changed area.
+        void setMotionGate(const bool &enabled, const int &threshold);
+
+        void setTrackerBackend(const TrackerBackend &backend);
+
+        void setMotionModel(const SpeedEstimator &speedEstimator, const size_t &trackerSkip);
+
+        void setHistoryLimits(const size_t &historyLength, const uint64_t &ttlFrames);
+
+        void setAssociation(const AssociationMethod &method, const double &minIou);
+
+        // Tracks are recorded with the index of their video source.
+        void setEventWriter(EventWriter *eventWriter);
+
+        [[nodiscard]] const ModelStartup &getModelStartup() const;
+
+    };
+
+} // namespace detector
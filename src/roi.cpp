@@ -0,0 +1,90 @@
+#include "roi.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace detector {
+
+    static vector<Polygon> readPolygons(const cv::FileStorage &storage, const string &key, const string &fileName) {
+        auto node = storage[key];
+        vector<Polygon> polygons;
+        if (node.empty()) {
+            return polygons;
+        }
+        for (const auto &polygonNode: node) {
+            Polygon polygon;
+            for (const auto &pointNode: polygonNode) {
+                if (pointNode.size() != 2) {
+                    throw std::runtime_error("Incorrect point in '" + key + "' of ROI config " + fileName +
+                                             ": points must be [x, y]");
+                }
+                polygon.emplace_back(static_cast<int>(pointNode[0]), static_cast<int>(pointNode[1]));
+            }
+            if (polygon.size() < 3) {
+                throw std::runtime_error("Incorrect polygon in '" + key + "' of ROI config " + fileName +
+                                         ": at least 3 points needed");
+            }
+            polygons.push_back(std::move(polygon));
+        }
+        return polygons;
+    }
+
+    RoiConfig loadRoiConfig(const string &fileName) {
+        cv::FileStorage storage(fileName, cv::FileStorage::READ);
+        if (!storage.isOpened()) {
+            throw std::runtime_error("Cannot open ROI config: " + fileName);
+        }
+        RoiConfig config;
+        config.roi = readPolygons(storage, "roi", fileName);
+        config.exclude = readPolygons(storage, "exclude", fileName);
+        config.measurementZones = readPolygons(storage, "measurement_zones", fileName);
+        auto tileBandNode = storage["tile_band"];
+        if (!tileBandNode.empty()) {
+            if (tileBandNode.size() != 2 || static_cast<int>(tileBandNode[0]) >= static_cast<int>(tileBandNode[1])) {
+                throw std::runtime_error("Incorrect 'tile_band' of ROI config " + fileName + ": must be [top, bottom]");
+            }
+            config.tileBand = cv::Range(static_cast<int>(tileBandNode[0]), static_cast<int>(tileBandNode[1]));
+        }
+        return config;
+    }
+
+    void RoiMask::build(const RoiConfig &config, const cv::Size2i &frameSize) {
+        _detectionMask.release();
+        _measurementMask.release();
+        _detectionRoi = cv::Rect2i();
+        if (!config.roi.empty() || !config.exclude.empty()) {
+            _detectionMask = cv::Mat(frameSize, CV_8UC1, cv::Scalar(config.roi.empty() ? 255 : 0));
+            if (!config.roi.empty()) {
+                cv::fillPoly(_detectionMask, config.roi, cv::Scalar(255));
+            }
+            cv::fillPoly(_detectionMask, config.exclude, cv::Scalar(0));
+        }
+        for (auto &polygon: config.roi) {
+            _detectionRoi |= cv::boundingRect(polygon);
+        }
+        _detectionRoi &= cv::Rect2i(0, 0, frameSize.width, frameSize.height);
+        if (_detectionRoi.area() == frameSize.area()) {
+            _detectionRoi = cv::Rect2i();
+        }
+        _tileBand = config.tileBand & cv::Range(0, frameSize.height);
+        if (!config.measurementZones.empty()) {
+            _measurementMask = cv::Mat(frameSize, CV_8UC1, cv::Scalar(0));
+            cv::fillPoly(_measurementMask, config.measurementZones, cv::Scalar(255));
+        }
+    }
+
+    bool RoiMask::contains(const cv::Mat &mask, const cv::Rect2i &bbox) {
+        auto x = std::clamp(bbox.x + bbox.width / 2, 0, mask.cols - 1);
+        auto y = std::clamp(bbox.y + bbox.height - 1, 0, mask.rows - 1);
+        return mask.at<uint8_t>(y, x) != 0;
+    }
+
+    bool RoiMask::acceptsDetection(const cv::Rect2i &bbox) const {
+        return _detectionMask.empty() || contains(_detectionMask, bbox);
+    }
+
+    bool RoiMask::isMeasured(const cv::Rect2i &bbox) const {
+        return _measurementMask.empty() || contains(_measurementMask, bbox);
+    }
+
+} // namespace detector
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "model.hpp"
+
+namespace detector {
+
+    using Polygon = vector<cv::Point2i>;
+
+    // Polygons of one camera in frame pixels. Without ROI polygons the whole frame is of interest;
+    // without measurement zones speeds are measured everywhere. Detection tiles only cover the rows of
+    // the tile band, typically around the horizon where objects are small.
+    struct RoiConfig {
+        vector<Polygon> roi;
+        vector<Polygon> exclude;
+        vector<Polygon> measurementZones;
+        cv::Range tileBand = cv::Range::all();
+    };
+
+    // Reads a cv::FileStorage file (YAML, JSON or XML) with optional 'roi', 'exclude' and
+    // 'measurement_zones' lists of polygons, each a list of [x, y] points, and an optional 'tile_band'
+    // [top, bottom] pair of rows, e.g. in YAML:
+    //   roi:
+    //     - [[0, 400], [1920, 400], [1920, 1080], [0, 1080]]
+    //   tile_band: [400, 700]
+    // Throws std::runtime_error naming the file and the key when the config cannot be read.
+    RoiConfig loadRoiConfig(const string &fileName);
+
+    // Masks rasterized from a RoiConfig for one frame size. Objects are placed by the middle of the
+    // bottom edge of their box, where they touch the ground, so a box reaching over the border of an
+    // area still belongs to the area it stands in.
+    class RoiMask {
+    private:
+
+        cv::Mat _detectionMask;
+        cv::Mat _measurementMask;
+        cv::Rect2i _detectionRoi;
+        cv::Range _tileBand = cv::Range::all();
+
+        [[nodiscard]] static bool contains(const cv::Mat &mask, const cv::Rect2i &bbox);
+
+    public:
+
+        void build(const RoiConfig &config, const cv::Size2i &frameSize);
+
+        // Bounding box of the ROI polygons, where the detector runs. Empty for the whole frame.
+        [[nodiscard]] const cv::Rect2i &getDetectionRoi() const { return _detectionRoi; }
+
+        // Frame rows detection tiles are restricted to.
+        [[nodiscard]] const cv::Range &getTileBand() const { return _tileBand; }
+
+        // Whether a tracker may be started for a detection: inside the ROI and outside exclusions.
+        [[nodiscard]] bool acceptsDetection(const cv::Rect2i &bbox) const;
+
+        [[nodiscard]] bool hasMeasurementZones() const { return !_measurementMask.empty(); }
+
+        [[nodiscard]] bool isMeasured(const cv::Rect2i &bbox) const;
+
+    };
+
+} // namespace detector
@@ -1,5 +1,8 @@
 #include "speed_detector.hpp"
 
+#include <algorithm>
+#include <cmath>
+
 namespace detector {
 
     unordered_map<ObjectClass, float> class2width{
@@ -26,9 +29,24 @@ namespace detector {
             {ObjectClass::TV_MONITOR,   12.},
     };
 
-    DetectedObject::DetectedObject(cv::Rect2i bbox, const int &objClass) : bbox(std::move(bbox)) {
-        meanWidth = class2width[static_cast<ObjectClass>(objClass)];
-        centroid = cv::Point2i(bbox.x + (bbox.width / 2), bbox.y + (bbox.height / 2));
+    // class2width flattened into an array for the per-object loop in updateSpeeds.
+    static std::array<float, static_cast<int>(ObjectClass::TV_MONITOR) + 1> makeClassWidths() {
+        std::array<float, static_cast<int>(ObjectClass::TV_MONITOR) + 1> widths{};
+        for (auto &[objClass, width]: class2width) {
+            widths[static_cast<int>(objClass)] = width;
+        }
+        return widths;
+    }
+
+    bool parseSpeedEstimator(const string &name, SpeedEstimator &estimator) {
+        if (name == "kalman") {
+            estimator = SpeedEstimator::KALMAN;
+        } else if (name == "history") {
+            estimator = SpeedEstimator::HISTORY;
+        } else {
+            return false;
+        }
+        return true;
     }
 
     double SpeedDetector::getDist(const int &x1, const int &x2, const int &y1, const int &y2) {
@@ -42,12 +60,12 @@ namespace detector {
 
     double SpeedDetector::estimateSpeed(const cv::Point2i &prevLoc,
                                         const cv::Point2i &curLoc,
-                                        const cv::Rect2i &bbox,
+                                        const int &objWidth,
                                         const float &meanObjWidth,
                                         const double &fps) {
         auto dPixels = getDist(prevLoc.x, curLoc.x, prevLoc.y, curLoc.y);
 //        std::clog << "dPixels: " << dPixels << std::endl;
-        auto pixelPerMeter = (bbox.width / meanObjWidth);
+        auto pixelPerMeter = (objWidth / meanObjWidth);
 //        std::clog << "pixelPerMeter: " << pixelPerMeter << std::endl;
         auto dMeters = dPixels / pixelPerMeter;
 //        std::clog << "dMeters: " << dMeters << std::endl;
@@ -55,32 +73,45 @@ namespace detector {
         return speed;
     }
 
-    SpeedDetector::SpeedDetector() {
-        _detectedObjects = unordered_map<int, queue<DetectedObject>>();
+    double SpeedDetector::estimateSpeed(const cv::Point2d &velocity,
+                                        const double &objWidth,
+                                        const float &meanObjWidth,
+                                        const double &fps) {
+        auto pixelPerMeter = objWidth / meanObjWidth;
+        return std::hypot(velocity.x, velocity.y) / pixelPerMeter * fps * 3.6;
     }
 
-    void SpeedDetector::addObject(const int &objID, const cv::Rect2i &objBbox, const int &objClass) {
-        if (_detectedObjects.find(objID) != _detectedObjects.end()) {
-            _detectedObjects[objID].push(DetectedObject(objBbox, objClass));
-        } else {
-            queue<DetectedObject> objQueue;
-            objQueue.push(DetectedObject(objBbox, objClass));
-            _detectedObjects[objID] = objQueue;
-        }
+    SpeedDetector::SpeedDetector() = default;
+
+    void SpeedDetector::setEstimator(const SpeedEstimator &estimator) {
+        _estimator = estimator;
     }
 
-    map<int, double> SpeedDetector::getObjectsSpeed(const double &fps) {
-        map<int, double> objSpeed;
-        for (auto&[objID, trackHistory]: _detectedObjects) {
-            auto recordsCount = trackHistory.size();
-            if (recordsCount > 1) {
-                auto prevLoc = trackHistory.back().centroid;
-                auto curLoc = trackHistory.front().centroid;
-                trackHistory.pop();
-                objSpeed[objID] = estimateSpeed(prevLoc, curLoc, trackHistory.back().bbox, trackHistory.back().meanWidth, fps);
+    void SpeedDetector::updateSpeeds(ObjectStore &objects, const double &fps) const {
+        static const auto classWidths = makeClassWidths();
+        if (_estimator == SpeedEstimator::KALMAN) {
+            for (size_t slot = 0; slot < objects.capacity(); slot++) {
+                if (!objects.isAlive(slot)) {
+                    continue;
+                }
+                auto &motion = objects.motion(slot);
+                objects.setSpeed(slot, estimateSpeed(motion.getVelocity(), std::max(1., motion.getWidth()),
+                                                     classWidths[objects.classId(slot)], fps));
+            }
+            return;
+        }
+        for (size_t slot = 0; slot < objects.capacity(); slot++) {
+            auto recordsCount = objects.historySize(slot);
+            if (!objects.isAlive(slot) || recordsCount < 2) {
+                continue;
             }
+            auto prevLoc = objects.historyCentroid(slot, 0);
+            auto curLoc = objects.historyCentroid(slot, recordsCount - 1);
+            // The history spans (recordsCount - 1) frames, average the displacement over all of them.
+            auto framesCount = static_cast<double>(recordsCount - 1);
+            objects.setSpeed(slot, estimateSpeed(prevLoc, curLoc, objects.historyWidth(slot, recordsCount - 1),
+                                                 classWidths[objects.classId(slot)], fps / framesCount));
         }
-        return objSpeed;
     }
 
 } // namespace detector
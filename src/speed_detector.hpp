@@ -1,37 +1,41 @@
+#pragma once
+
+#include <array>
 #include <map>
-#include <stack>
-#include <unordered_map>
 #include <utility>
 
-#include "model.hpp"
+#include "object_store.hpp"
 
 //#define USE_TAXICAB_SQRT
 
 namespace detector {
 
     using std::map;
-    using std::queue;
-
-    struct DetectedObject {
-
-        cv::Point2i centroid;
-        cv::Rect2i bbox;
-        float meanWidth;
-
-        explicit DetectedObject(cv::Rect2i bbox, const int &objClass);
 
+    enum class SpeedEstimator : int {
+        KALMAN = 0,
+        HISTORY
     };
 
+    bool parseSpeedEstimator(const string &name, SpeedEstimator &estimator);
+
+    // Speeds come either from the velocity of the object's motion filter (KALMAN), or from the
+    // displacement between the oldest and the latest recorded positions (HISTORY).
     class SpeedDetector {
     private:
 
-        unordered_map<int, queue<DetectedObject>> _detectedObjects;
+        SpeedEstimator _estimator = SpeedEstimator::KALMAN;
 
         static double getDist(const int &x1, const int &x2, const int &y1, const int &y2);
 
         static double estimateSpeed(const cv::Point2i &prevLoc,
                                     const cv::Point2i &curLoc,
-                                    const cv::Rect2i &bbox,
+                                    const int &objWidth,
+                                    const float &meanObjWidth,
+                                    const double &fps);
+
+        static double estimateSpeed(const cv::Point2d &velocity,
+                                    const double &objWidth,
                                     const float &meanObjWidth,
                                     const double &fps);
 
@@ -39,9 +43,9 @@ namespace detector {
 
         explicit SpeedDetector();
 
-        void addObject(const int &objID, const cv::Rect2i &objBbox, const int &objClass);
+        void setEstimator(const SpeedEstimator &estimator);
 
-        map<int, double> getObjectsSpeed(const double &fps);
+        void updateSpeeds(ObjectStore &objects, const double &fps) const;
 
     };
 
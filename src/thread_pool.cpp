@@ -0,0 +1,88 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+namespace detector {
+
+    ThreadPool::ThreadPool(const size_t &nThreads) {
+        for (size_t i = 1; i < nThreads; i++) {
+            _workers.emplace_back(&ThreadPool::work, this);
+        }
+    }
+
+    ThreadPool::~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopped = true;
+        }
+        _taskCond.notify_all();
+        for (auto &worker: _workers) {
+            worker.join();
+        }
+    }
+
+    size_t ThreadPool::size() const {
+        return _workers.size() + 1;
+    }
+
+    void ThreadPool::runChunks() {
+        while (true) {
+            auto first = _nextTask.fetch_add(_chunkSize);
+            if (first >= _nTasks) {
+                return;
+            }
+            auto last = std::min(first + _chunkSize, _nTasks);
+            for (auto i = first; i < last; i++) {
+                (*_task)(i);
+            }
+        }
+    }
+
+    void ThreadPool::work() {
+        uint64_t seenGeneration = 0;
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+            _taskCond.wait(lock, [&] { return _stopped || _generation != seenGeneration; });
+            if (_stopped) {
+                return;
+            }
+            seenGeneration = _generation;
+            _activeWorkers++;
+            lock.unlock();
+            runChunks();
+            lock.lock();
+            if (--_activeWorkers == 0) {
+                _doneCond.notify_all();
+            }
+        }
+    }
+
+    void ThreadPool::parallelFor(const size_t &n, const std::function<void(size_t)> &task) {
+        if (_workers.empty() || n < 2) {
+            for (size_t i = 0; i < n; i++) {
+                task(i);
+            }
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            // A worker that woke up too late for the previous loop may still be leaving it.
+            _doneCond.wait(lock, [this] { return _activeWorkers == 0; });
+            _task = &task;
+            _nTasks = n;
+            // Several chunks per thread keep the load balanced when per-item cost varies.
+            _chunkSize = std::max<size_t>(1, n / (4 * size()));
+            _nextTask = 0;
+            _generation++;
+        }
+        _taskCond.notify_all();
+        runChunks();
+
+        // Workers that woke up late find no chunks left and leave immediately, so waiting for the
+        // active ones to finish is enough for every index to be processed.
+        std::unique_lock<std::mutex> lock(_mutex);
+        _doneCond.wait(lock, [this] { return _activeWorkers == 0; });
+        _task = nullptr;
+    }
+
+} // namespace detector
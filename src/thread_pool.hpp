@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace detector {
+
+    using std::vector;
+
+    // Persistent set of worker threads for data-parallel loops. parallelFor() splits [0, n) into
+    // small chunks that idle workers claim from a shared counter, so faster workers take over the
+    // remaining work of slower ones. The calling thread takes part in the loop and the call returns
+    // only once every index has been processed.
+    class ThreadPool {
+    private:
+
+        vector<std::thread> _workers;
+
+        const std::function<void(size_t)> *_task = nullptr;
+        size_t _nTasks = 0;
+        size_t _chunkSize = 1;
+        std::atomic<size_t> _nextTask{0};
+        size_t _activeWorkers = 0;
+        uint64_t _generation = 0;
+        bool _stopped = false;
+
+        std::mutex _mutex;
+        std::condition_variable _taskCond;
+        std::condition_variable _doneCond;
+
+        void work();
+
+        void runChunks();
+
+    public:
+
+        explicit ThreadPool(const size_t &nThreads);
+
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        [[nodiscard]] size_t size() const;
+
+        void parallelFor(const size_t &n, const std::function<void(size_t)> &task);
+
+    };
+
+} // namespace detector